@@ -9,8 +9,17 @@
 #ifdef USERPROG
 #include "userprog/exception.h"
 #endif
+#ifdef VM
+#include "vm/frame.h"
+#include "vm/pageout.h"
+#include "vm/zswap.h"
+#include "vm/prefetch.h"
+#include "vm/mmap.h"
+#include "vm/advise.h"
+#endif
 #ifdef FILESYS
 #include "devices/block.h"
+#include "filesys/cache.h"
 #include "filesys/filesys.h"
 #endif
 
@@ -124,10 +133,19 @@ print_stats (void)
   thread_print_stats ();
 #ifdef FILESYS
   block_print_stats ();
+  cache_print_stats ();
 #endif
   console_print_stats ();
   kbd_print_stats ();
 #ifdef USERPROG
   exception_print_stats ();
 #endif
+#ifdef VM
+  ft_print_stats ();
+  pageout_print_stats ();
+  zswap_print_stats ();
+  prefetch_print_stats ();
+  mmap_print_stats ();
+  advise_print_stats ();
+#endif
 }
@@ -0,0 +1,403 @@
+#include "filesys/cache.h"
+#include <debug.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "filesys/filesys.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* Ticks between the write-behind thread's passes over the cache. */
+#define WRITE_BEHIND_INTERVAL TIMER_FREQ
+
+/* Most read-ahead requests waiting at once.  Further requests are
+   dropped, as the reader is then ahead of the disk anyway. */
+#define READ_AHEAD_MAX 16
+
+/* A run of consecutive sectors to read ahead. */
+struct read_ahead
+  {
+    block_sector_t sector;              /* First sector. */
+    size_t cnt;                         /* Number of sectors. */
+  };
+
+/* A sector held in the cache.
+
+   SECTOR, IN_USE, ACCESSED and USERS are protected by cache_lock.
+   VALID, DIRTY and DATA are protected by LOCK, which is only ever
+   taken by a thread counted in USERS, so that they may also be
+   used with cache_lock held while USERS is 0. */
+struct cache_entry
+  {
+    block_sector_t sector;              /* Sector held, if IN_USE. */
+    bool in_use;                        /* False if the entry is free. */
+    bool accessed;                      /* Used since the clock hand
+                                           last passed. */
+    unsigned users;                     /* Threads using the entry,
+                                           which keep it from being
+                                           evicted. */
+    struct lock lock;                   /* Held while using DATA. */
+    bool valid;                         /* DATA holds the sector. */
+    bool dirty;                         /* DATA is newer than the disk. */
+    uint8_t data[BLOCK_SECTOR_SIZE];    /* Contents of the sector. */
+  };
+
+static struct cache_entry cache[CACHE_SIZE];
+static struct lock cache_lock;
+static struct condition entry_released; /* Some entry's USERS became 0. */
+static size_t clock_hand;               /* Next entry to consider. */
+
+/* Runs waiting to be read ahead, a ring protected by
+   cache_lock. */
+static struct read_ahead read_ahead_queue[READ_AHEAD_MAX];
+static size_t read_ahead_head;
+static size_t read_ahead_cnt;
+static struct condition read_ahead_ready;
+
+/* Statistics. */
+static long long hit_cnt;
+static long long miss_cnt;
+static long long read_ahead_done_cnt;
+static long long write_back_cnt;
+
+static struct cache_entry *cache_acquire (block_sector_t, bool count);
+static void cache_release (struct cache_entry *);
+static struct cache_entry *cache_find (block_sector_t);
+static struct cache_entry *cache_choose_victim (void);
+static void cache_load (struct cache_entry *);
+static void cache_write_back (struct cache_entry *);
+static thread_func write_behind_daemon NO_RETURN;
+static thread_func read_ahead_daemon NO_RETURN;
+
+/* Initializes the buffer cache and starts its write-behind and
+   read-ahead threads. */
+void
+cache_init (void)
+{
+  size_t i;
+
+  lock_init (&cache_lock);
+  cond_init (&entry_released);
+  cond_init (&read_ahead_ready);
+  for (i = 0; i < CACHE_SIZE; i++)
+    {
+      cache[i].in_use = false;
+      cache[i].users = 0;
+      lock_init (&cache[i].lock);
+    }
+
+  thread_create ("cache-flush", PRI_DEFAULT, write_behind_daemon, NULL);
+  thread_create ("read-ahead", PRI_DEFAULT, read_ahead_daemon, NULL);
+}
+
+/* Reads sector SECTOR into BUFFER, which must have room for
+   BLOCK_SECTOR_SIZE bytes. */
+void
+cache_read (block_sector_t sector, void *buffer)
+{
+  cache_read_at (sector, buffer, 0, BLOCK_SECTOR_SIZE);
+}
+
+/* Reads SIZE bytes starting at byte OFS of sector SECTOR into
+   BUFFER. */
+void
+cache_read_at (block_sector_t sector, void *buffer, int ofs, int size)
+{
+  struct cache_entry *e;
+
+  ASSERT (ofs >= 0 && size >= 0 && ofs + size <= BLOCK_SECTOR_SIZE);
+
+  e = cache_acquire (sector, true);
+  cache_load (e);
+  memcpy (buffer, e->data + ofs, size);
+  cache_release (e);
+}
+
+/* Writes BLOCK_SECTOR_SIZE bytes from BUFFER to sector SECTOR. */
+void
+cache_write (block_sector_t sector, const void *buffer)
+{
+  cache_write_at (sector, buffer, 0, BLOCK_SECTOR_SIZE);
+}
+
+/* Writes SIZE bytes from BUFFER to sector SECTOR, starting at
+   byte OFS.  The sector only reaches the disk when it is evicted
+   or flushed. */
+void
+cache_write_at (block_sector_t sector, const void *buffer, int ofs, int size)
+{
+  struct cache_entry *e;
+
+  ASSERT (ofs >= 0 && size >= 0 && ofs + size <= BLOCK_SECTOR_SIZE);
+
+  e = cache_acquire (sector, true);
+  if (size < BLOCK_SECTOR_SIZE)
+    cache_load (e);
+  memcpy (e->data + ofs, buffer, size);
+  e->valid = true;
+  e->dirty = true;
+  cache_release (e);
+}
+
+/* Asks for the CNT consecutive sectors starting at SECTOR, at
+   most READ_AHEAD_RUN, to be read into the cache in the
+   background with a single multi-sector read, because they are
+   likely to be read soon. */
+void
+cache_read_ahead (block_sector_t sector, size_t cnt)
+{
+  struct read_ahead *ra;
+  size_t i;
+
+  ASSERT (cnt > 0 && cnt <= READ_AHEAD_RUN);
+
+  lock_acquire (&cache_lock);
+  if (cache_find (sector) != NULL || read_ahead_cnt >= READ_AHEAD_MAX)
+    goto done;
+  for (i = 0; i < read_ahead_cnt; i++)
+    if (read_ahead_queue[(read_ahead_head + i) % READ_AHEAD_MAX].sector
+        == sector)
+      goto done;
+
+  ra = &read_ahead_queue[(read_ahead_head + read_ahead_cnt++)
+                         % READ_AHEAD_MAX];
+  ra->sector = sector;
+  ra->cnt = cnt;
+  cond_signal (&read_ahead_ready, &cache_lock);
+
+ done:
+  lock_release (&cache_lock);
+}
+
+/* Writes every dirty sector in the cache to disk. */
+void
+cache_flush (void)
+{
+  size_t i;
+
+  for (i = 0; i < CACHE_SIZE; i++)
+    {
+      struct cache_entry *e = &cache[i];
+
+      lock_acquire (&cache_lock);
+      if (!e->in_use || (e->users == 0 && !e->dirty))
+        {
+          lock_release (&cache_lock);
+          continue;
+        }
+      e->users++;
+      lock_release (&cache_lock);
+
+      lock_acquire (&e->lock);
+      cache_write_back (e);
+      cache_release (e);
+    }
+}
+
+/* Prints buffer cache statistics. */
+void
+cache_print_stats (void)
+{
+  printf ("Cache: %lld hits, %lld misses, %lld sectors read ahead, "
+          "%lld written back\n",
+          hit_cnt, miss_cnt, read_ahead_done_cnt, write_back_cnt);
+}
+
+/* Returns the entry holding sector SECTOR, with its lock held,
+   evicting another sector if SECTOR is not cached.  The entry's
+   data has not necessarily been read yet.
+   Counts a hit or a miss if COUNT is true. */
+static struct cache_entry *
+cache_acquire (block_sector_t sector, bool count)
+{
+  struct cache_entry *e;
+
+  lock_acquire (&cache_lock);
+  for (;;)
+    {
+      e = cache_find (sector);
+      if (e != NULL)
+        {
+          if (count)
+            hit_cnt++;
+          break;
+        }
+
+      e = cache_choose_victim ();
+      if (e == NULL)
+        {
+          cond_wait (&entry_released, &cache_lock);
+          continue;
+        }
+
+      if (e->in_use && e->dirty)
+        {
+          /* Write the victim back while it still holds its
+             sector, so that nobody reads the sector from disk in
+             the meantime, then choose again. */
+          e->users++;
+          lock_release (&cache_lock);
+          lock_acquire (&e->lock);
+          cache_write_back (e);
+          lock_release (&e->lock);
+          lock_acquire (&cache_lock);
+          if (--e->users == 0)
+            cond_signal (&entry_released, &cache_lock);
+          continue;
+        }
+
+      if (count)
+        miss_cnt++;
+      e->sector = sector;
+      e->in_use = true;
+      e->valid = false;
+      e->dirty = false;
+      break;
+    }
+  e->users++;
+  e->accessed = true;
+  lock_release (&cache_lock);
+
+  lock_acquire (&e->lock);
+  return e;
+}
+
+/* Stops using entry E, acquired with cache_acquire(). */
+static void
+cache_release (struct cache_entry *e)
+{
+  lock_release (&e->lock);
+
+  lock_acquire (&cache_lock);
+  if (--e->users == 0)
+    cond_signal (&entry_released, &cache_lock);
+  lock_release (&cache_lock);
+}
+
+/* Returns the entry holding sector SECTOR, or a null pointer if
+   it is not cached.
+   Must be called with cache_lock held. */
+static struct cache_entry *
+cache_find (block_sector_t sector)
+{
+  size_t i;
+
+  for (i = 0; i < CACHE_SIZE; i++)
+    if (cache[i].in_use && cache[i].sector == sector)
+      return &cache[i];
+  return NULL;
+}
+
+/* Chooses an entry to reuse with the clock algorithm: a free
+   entry, or else the first unused entry that has not been
+   accessed since the hand last passed it.
+   Returns a null pointer if every entry is in use.
+   Must be called with cache_lock held. */
+static struct cache_entry *
+cache_choose_victim (void)
+{
+  size_t i;
+
+  for (i = 0; i < 2 * CACHE_SIZE; i++)
+    {
+      struct cache_entry *e = &cache[clock_hand];
+      clock_hand = (clock_hand + 1) % CACHE_SIZE;
+
+      if (!e->in_use)
+        return e;
+      if (e->users > 0)
+        continue;
+      if (e->accessed)
+        e->accessed = false;
+      else
+        return e;
+    }
+  return NULL;
+}
+
+/* Reads E's sector from disk unless E already holds it.
+   Must be called with E's lock held. */
+static void
+cache_load (struct cache_entry *e)
+{
+  if (!e->valid)
+    {
+      block_read (fs_device, e->sector, e->data);
+      e->valid = true;
+    }
+}
+
+/* Writes E's sector to disk if it is dirty.
+   Must be called with E's lock held. */
+static void
+cache_write_back (struct cache_entry *e)
+{
+  if (e->valid && e->dirty)
+    {
+      block_write (fs_device, e->sector, e->data);
+      e->dirty = false;
+      write_back_cnt++;
+    }
+}
+
+/* Periodically writes dirty sectors to disk, so that little is
+   lost if the machine stops without filesys_done() being
+   called. */
+static void
+write_behind_daemon (void *aux UNUSED)
+{
+  for (;;)
+    {
+      timer_sleep (WRITE_BEHIND_INTERVAL);
+      cache_flush ();
+    }
+}
+
+/* Reads the runs queued by cache_read_ahead() into the cache.
+   Every entry of a run is held while the run is read with one
+   multi-sector transfer, then the sectors that were not already
+   cached are copied in.  This is the only thread that holds more
+   than one entry at a time, so it cannot deadlock waiting for
+   more. */
+static void
+read_ahead_daemon (void *aux UNUSED)
+{
+  static uint8_t buffer[READ_AHEAD_RUN * BLOCK_SECTOR_SIZE];
+
+  for (;;)
+    {
+      struct cache_entry *run[READ_AHEAD_RUN];
+      struct read_ahead ra;
+      bool missing = false;
+      size_t i;
+
+      lock_acquire (&cache_lock);
+      while (read_ahead_cnt == 0)
+        cond_wait (&read_ahead_ready, &cache_lock);
+      ra = read_ahead_queue[read_ahead_head];
+      read_ahead_head = (read_ahead_head + 1) % READ_AHEAD_MAX;
+      read_ahead_cnt--;
+      lock_release (&cache_lock);
+
+      for (i = 0; i < ra.cnt; i++)
+        {
+          run[i] = cache_acquire (ra.sector + i, false);
+          missing = missing || !run[i]->valid;
+        }
+
+      if (missing)
+        block_read_multiple (fs_device, ra.sector, ra.cnt, buffer);
+
+      for (i = 0; i < ra.cnt; i++)
+        {
+          if (!run[i]->valid)
+            {
+              memcpy (run[i]->data, buffer + i * BLOCK_SECTOR_SIZE,
+                      BLOCK_SECTOR_SIZE);
+              run[i]->valid = true;
+              read_ahead_done_cnt++;
+            }
+          cache_release (run[i]);
+        }
+    }
+}
@@ -0,0 +1,21 @@
+#ifndef FILESYS_CACHE_H
+#define FILESYS_CACHE_H
+
+#include "devices/block.h"
+
+/* Number of sectors held in the buffer cache. */
+#define CACHE_SIZE 64
+
+/* Most consecutive sectors read ahead in one request. */
+#define READ_AHEAD_RUN 8
+
+void cache_init (void);
+void cache_read (block_sector_t, void *);
+void cache_read_at (block_sector_t, void *, int ofs, int size);
+void cache_write (block_sector_t, const void *);
+void cache_write_at (block_sector_t, const void *, int ofs, int size);
+void cache_read_ahead (block_sector_t, size_t cnt);
+void cache_flush (void);
+void cache_print_stats (void);
+
+#endif /* filesys/cache.h */
@@ -1,25 +1,56 @@
 #include "filesys/inode.h"
 #include <list.h>
 #include <debug.h>
+#include <hash.h>
 #include <round.h>
 #include <string.h>
+#include "filesys/cache.h"
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
 
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
 
+/* Number of extents in an inode, and number of data sectors
+   an inode points to through one and two levels of indirection
+   once its extents are used up. */
+#define EXTENT_CNT 62
+#define INDIRECT_CNT (BLOCK_SECTOR_SIZE / sizeof (block_sector_t))
+#define DOUBLY_INDIRECT_CNT (INDIRECT_CNT * INDIRECT_CNT)
+
+/* A run of consecutive data sectors. */
+struct extent
+  {
+    block_sector_t start;               /* First sector. */
+    block_sector_t length;              /* Number of sectors, 0 if the
+                                           extent is not used. */
+  };
+
 /* On-disk inode.
-   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+   Must be exactly BLOCK_SECTOR_SIZE bytes long.
+   The used extents map the start of the file without gaps.
+   Once all of them are used and the last cannot grow in place,
+   the rest of the file is mapped one sector at a time through
+   the indirect sectors, after which the extents never change.
+   There, a sector number of 0, which always holds the free map
+   inode, means that no sector has been allocated, so that the
+   data there reads as zeros. */
 struct inode_disk
   {
-    block_sector_t start;               /* First data sector. */
+    struct extent extents[EXTENT_CNT];  /* First data sectors. */
+    block_sector_t indirect;            /* Sector of INDIRECT_CNT more
+                                           data sector numbers. */
+    block_sector_t doubly_indirect;     /* Sector of INDIRECT_CNT
+                                           indirect sector numbers. */
     off_t length;                       /* File size in bytes. */
     unsigned magic;                     /* Magic number. */
-    uint32_t unused[125];               /* Not used. */
   };
 
+/* A sector of zeros. */
+static char zeros[BLOCK_SECTOR_SIZE];
+
 /* Returns the number of sectors to allocate for an inode SIZE
    bytes long. */
 static inline size_t
@@ -28,45 +59,261 @@ bytes_to_sectors (off_t size)
   return DIV_ROUND_UP (size, BLOCK_SECTOR_SIZE);
 }
 
-/* In-memory inode. */
+/* In-memory inode.
+   ELEM, LRU_ELEM, OPEN_CNT and REMOVED are protected by
+   inodes_lock, DENY_WRITE_CNT, DATA and the file's contents by
+   RWLOCK.  NEXT_READ is only a hint, see inode_read_at(). */
 struct inode 
   {
-    struct list_elem elem;              /* Element in inode list. */
+    struct hash_elem elem;              /* Element in `inodes'. */
+    struct list_elem lru_elem;          /* Element in `closed_inodes',
+                                           if OPEN_CNT is 0. */
     block_sector_t sector;              /* Sector number of disk location. */
     int open_cnt;                       /* Number of openers. */
     bool removed;                       /* True if deleted, false otherwise. */
     int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
+    off_t next_read;                    /* Offset following the last read,
+                                           to detect sequential reads. */
+    struct rwlock rwlock;               /* Held to read or write. */
+    struct lock lock;                   /* Held by inode_lock(). */
     struct inode_disk data;             /* Inode content. */
   };
 
+/* Returns the sector number in *SLOT.  If it is 0 and ALLOCATE
+   is true, first allocates a sector filled with zeros, stores it
+   in *SLOT and sets *CHANGED to true.
+   Returns 0 if no sector is or could be allocated. */
+static block_sector_t
+get_sector (block_sector_t *slot, bool allocate, bool *changed)
+{
+  if (*slot == 0 && allocate && free_map_allocate (1, slot))
+    {
+      cache_write (*slot, zeros);
+      *changed = true;
+    }
+  return *slot;
+}
+
+/* Returns entry IDX of index sector INDEX, allocating a sector
+   for it if it is 0 and ALLOCATE is true.
+   Returns 0 if no sector is or could be allocated. */
+static block_sector_t
+get_index_entry (block_sector_t index, size_t idx, bool allocate)
+{
+  block_sector_t sector;
+  bool changed = false;
+
+  cache_read_at (index, &sector, idx * sizeof sector, sizeof sector);
+  get_sector (&sector, allocate, &changed);
+  if (changed)
+    cache_write_at (index, &sector, idx * sizeof sector, sizeof sector);
+  return sector;
+}
+
+/* Allocates up to CNT consecutive sectors, as many as free
+   space allows, and fills them with zeros.  If AT is true the
+   sectors must start at *START, so that an extent can grow in
+   place, otherwise the first is stored in *START.
+   Returns the number of sectors allocated. */
+static size_t
+allocate_run (block_sector_t *start, size_t cnt, bool at)
+{
+  size_t i;
+
+  while (cnt > 0
+         && !(at ? free_map_allocate_at (*start, cnt)
+                 : free_map_allocate (cnt, start)))
+    cnt /= 2;
+
+  for (i = 0; i < cnt; i++)
+    cache_write (*start + i, zeros);
+  return cnt;
+}
+
+/* Grows the extents of DISK_INODE until they map its first
+   SECTORS sectors, first by extending the last extent in place
+   and only then by starting a new one, setting *CHANGED to true
+   if they grow.
+   Stops early once every extent is used and the last cannot
+   grow, or once the sectors past the extents have been mapped
+   through the indirect sectors.
+   Returns false if the disk is full. */
+static bool
+extend_extents (struct inode_disk *disk_inode, size_t sectors, bool *changed)
+{
+  size_t cnt = 0;
+  size_t mapped = 0;
+
+  if (disk_inode->indirect != 0 || disk_inode->doubly_indirect != 0)
+    return true;
+
+  while (cnt < EXTENT_CNT && disk_inode->extents[cnt].length > 0)
+    mapped += disk_inode->extents[cnt++].length;
+
+  while (mapped < sectors)
+    {
+      struct extent *last = cnt > 0 ? &disk_inode->extents[cnt - 1] : NULL;
+      block_sector_t start;
+      size_t got = 0;
+
+      if (last != NULL)
+        {
+          start = last->start + last->length;
+          got = allocate_run (&start, sectors - mapped, true);
+          last->length += got;
+        }
+
+      if (got == 0)
+        {
+          if (cnt == EXTENT_CNT)
+            return true;
+
+          got = allocate_run (&start, sectors - mapped, false);
+          if (got == 0)
+            return false;
+          disk_inode->extents[cnt].start = start;
+          disk_inode->extents[cnt++].length = got;
+        }
+
+      mapped += got;
+      *changed = true;
+    }
+  return true;
+}
+
 /* Returns the block device sector that contains byte offset POS
-   within INODE.
-   Returns -1 if INODE does not contain data for a byte at offset
-   POS. */
+   within the data of DISK_INODE, which is found in an extent or
+   looked up through at most two index sectors.
+   If ALLOCATE is true, allocates the sector and any sectors
+   before it in the extents or index sectors leading to it that
+   are missing, and sets *CHANGED to true if DISK_INODE itself
+   changed.
+   Returns 0 if no sector is or could be allocated, or if POS is
+   past the largest possible file. */
 static block_sector_t
-byte_to_sector (const struct inode *inode, off_t pos) 
+byte_to_sector (struct inode_disk *disk_inode, off_t pos, bool allocate,
+                bool *changed)
 {
-  ASSERT (inode != NULL);
-  if (pos < inode->data.length)
-    return inode->data.start + pos / BLOCK_SECTOR_SIZE;
-  else
-    return -1;
+  size_t idx = pos / BLOCK_SECTOR_SIZE;
+  block_sector_t index;
+  size_t i;
+
+  if (allocate && !extend_extents (disk_inode, idx + 1, changed))
+    return 0;
+
+  for (i = 0; i < EXTENT_CNT && disk_inode->extents[i].length > 0; i++)
+    {
+      if (idx < disk_inode->extents[i].length)
+        return disk_inode->extents[i].start + idx;
+      idx -= disk_inode->extents[i].length;
+    }
+
+  if (idx < INDIRECT_CNT)
+    {
+      index = get_sector (&disk_inode->indirect, allocate, changed);
+      return index != 0 ? get_index_entry (index, idx, allocate) : 0;
+    }
+  idx -= INDIRECT_CNT;
+
+  if (idx < DOUBLY_INDIRECT_CNT)
+    {
+      index = get_sector (&disk_inode->doubly_indirect, allocate, changed);
+      if (index != 0)
+        index = get_index_entry (index, idx / INDIRECT_CNT, allocate);
+      return index != 0
+             ? get_index_entry (index, idx % INDIRECT_CNT, allocate) : 0;
+    }
+
+  return 0;
 }
 
-/* List of open inodes, so that opening a single inode twice
-   returns the same `struct inode'. */
-static struct list open_inodes;
+/* Releases the sectors pointed to by index sector INDEX, which
+   has LEVELS levels of index sectors below it, and INDEX itself. */
+static void
+release_index (block_sector_t index, int levels)
+{
+  size_t i;
+
+  if (index == 0)
+    return;
+
+  for (i = 0; i < INDIRECT_CNT; i++)
+    {
+      block_sector_t sector;
+
+      cache_read_at (index, &sector, i * sizeof sector, sizeof sector);
+      if (levels > 0)
+        release_index (sector, levels - 1);
+      else if (sector != 0)
+        free_map_release (sector, 1);
+    }
+  free_map_release (index, 1);
+}
+
+/* Releases every data and index sector of DISK_INODE. */
+static void
+release_sectors (struct inode_disk *disk_inode)
+{
+  size_t i;
+
+  for (i = 0; i < EXTENT_CNT && disk_inode->extents[i].length > 0; i++)
+    free_map_release (disk_inode->extents[i].start,
+                      disk_inode->extents[i].length);
+  release_index (disk_inode->indirect, 0);
+  release_index (disk_inode->doubly_indirect, 1);
+}
+
+/* Most closed inodes kept in memory. */
+#define CLOSED_INODES_MAX 16
+
+/* Inodes in memory, hashed by sector, so that opening a single
+   inode twice returns the same `struct inode'.  Besides the open
+   inodes it holds the most recently closed ones, so that inodes
+   opened over and over, such as the root directory's, are not read
+   again each time.  Their in-memory copy stays current because
+   every change to an inode is made through it. */
+static struct hash inodes;
+
+/* Closed inodes still in `inodes', most recently closed first. */
+static struct list closed_inodes;
+
+static struct lock inodes_lock;
+
+static hash_hash_func inode_hash;
+static hash_less_func inode_less;
 
 /* Initializes the inode module. */
 void
 inode_init (void) 
 {
-  list_init (&open_inodes);
+  if (!hash_init (&inodes, inode_hash, inode_less, NULL))
+    PANIC ("inode table creation failed");
+  list_init (&closed_inodes);
+  lock_init (&inodes_lock);
+}
+
+/* Returns a hash value for the inode that contains E. */
+static unsigned
+inode_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct inode *inode = hash_entry (e, struct inode, elem);
+  return hash_int (inode->sector);
+}
+
+/* Returns true if the inode that contains A has a lower sector
+   number than the one that contains B. */
+static bool
+inode_less (const struct hash_elem *a, const struct hash_elem *b,
+            void *aux UNUSED)
+{
+  return (hash_entry (a, struct inode, elem)->sector
+          < hash_entry (b, struct inode, elem)->sector);
 }
 
 /* Initializes an inode with LENGTH bytes of data and
    writes the new inode to sector SECTOR on the file system
-   device.
+   device.  The data is allocated in as few extents as free space
+   allows, so a fragmented disk can still hold a large file.
    Returns true if successful.
    Returns false if memory or disk allocation fails. */
 bool
@@ -85,21 +332,24 @@ inode_create (block_sector_t sector, off_t length)
   if (disk_inode != NULL)
     {
       size_t sectors = bytes_to_sectors (length);
+      bool changed = false;
+      size_t i = 0;
+
       disk_inode->length = length;
       disk_inode->magic = INODE_MAGIC;
-      if (free_map_allocate (sectors, &disk_inode->start)) 
+      if (extend_extents (disk_inode, sectors, &changed))
+        for (i = 0; i < sectors; i++)
+          if (byte_to_sector (disk_inode, i * BLOCK_SECTOR_SIZE, true,
+                              &changed) == 0)
+            break;
+
+      if (i == sectors)
         {
-          block_write (fs_device, sector, disk_inode);
-          if (sectors > 0) 
-            {
-              static char zeros[BLOCK_SECTOR_SIZE];
-              size_t i;
-              
-              for (i = 0; i < sectors; i++) 
-                block_write (fs_device, disk_inode->start + i, zeros);
-            }
-          success = true; 
-        } 
+          cache_write (sector, disk_inode);
+          success = true;
+        }
+      else
+        release_sectors (disk_inode);
       free (disk_inode);
     }
   return success;
@@ -111,33 +361,42 @@ inode_create (block_sector_t sector, off_t length)
 struct inode *
 inode_open (block_sector_t sector)
 {
-  struct list_elem *e;
+  struct inode key;
+  struct hash_elem *e;
   struct inode *inode;
 
-  /* Check whether this inode is already open. */
-  for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-       e = list_next (e)) 
+  lock_acquire (&inodes_lock);
+
+  /* Check whether this inode is already in memory. */
+  key.sector = sector;
+  e = hash_find (&inodes, &key.elem);
+  if (e != NULL)
     {
-      inode = list_entry (e, struct inode, elem);
-      if (inode->sector == sector) 
-        {
-          inode_reopen (inode);
-          return inode; 
-        }
+      inode = hash_entry (e, struct inode, elem);
+      if (inode->open_cnt++ == 0)
+        list_remove (&inode->lru_elem);
+      goto done;
     }
 
   /* Allocate memory. */
   inode = malloc (sizeof *inode);
   if (inode == NULL)
-    return NULL;
+    goto done;
 
-  /* Initialize. */
-  list_push_front (&open_inodes, &inode->elem);
+  /* Initialize.  The inode is read before the lock is released,
+     so that nobody finds it in the table half initialized. */
   inode->sector = sector;
+  hash_insert (&inodes, &inode->elem);
   inode->open_cnt = 1;
   inode->deny_write_cnt = 0;
   inode->removed = false;
-  block_read (fs_device, inode->sector, &inode->data);
+  inode->next_read = 0;
+  rwlock_init (&inode->rwlock);
+  lock_init (&inode->lock);
+  cache_read (inode->sector, &inode->data);
+
+ done:
+  lock_release (&inodes_lock);
   return inode;
 }
 
@@ -146,7 +405,11 @@ struct inode *
 inode_reopen (struct inode *inode)
 {
   if (inode != NULL)
-    inode->open_cnt++;
+    {
+      lock_acquire (&inodes_lock);
+      inode->open_cnt++;
+      lock_release (&inodes_lock);
+    }
   return inode;
 }
 
@@ -158,31 +421,47 @@ inode_get_inumber (const struct inode *inode)
 }
 
 /* Closes INODE and writes it to disk.
-   If this was the last reference to INODE, frees its memory.
-   If INODE was also a removed inode, frees its blocks. */
+   If this was the last reference to INODE, keeps it among the
+   recently closed inodes, freeing the memory of the least
+   recently closed one if there are too many.
+   If INODE was also a removed inode, frees its memory and its
+   blocks. */
 void
 inode_close (struct inode *inode) 
 {
+  struct inode *victim = NULL;
+
   /* Ignore null pointer. */
   if (inode == NULL)
     return;
 
-  /* Release resources if this was the last opener. */
+  lock_acquire (&inodes_lock);
   if (--inode->open_cnt == 0)
     {
-      /* Remove from inode list and release lock. */
-      list_remove (&inode->elem);
- 
-      /* Deallocate blocks if removed. */
-      if (inode->removed) 
+      if (inode->removed)
         {
+          /* Drop it from the table before its sector can be
+             reused by a new inode. */
+          hash_delete (&inodes, &inode->elem);
+          lock_release (&inodes_lock);
+
           free_map_release (inode->sector, 1);
-          free_map_release (inode->data.start,
-                            bytes_to_sectors (inode->data.length)); 
+          release_sectors (&inode->data);
+          free (inode);
+          return;
         }
 
-      free (inode); 
+      list_push_front (&closed_inodes, &inode->lru_elem);
+      if (list_size (&closed_inodes) > CLOSED_INODES_MAX)
+        {
+          victim = list_entry (list_pop_back (&closed_inodes),
+                               struct inode, lru_elem);
+          hash_delete (&inodes, &victim->elem);
+        }
     }
+  lock_release (&inodes_lock);
+
+  free (victim);
 }
 
 /* Marks INODE to be deleted when it is closed by the last caller who
@@ -191,27 +470,81 @@ void
 inode_remove (struct inode *inode) 
 {
   ASSERT (inode != NULL);
+  lock_acquire (&inodes_lock);
   inode->removed = true;
+  lock_release (&inodes_lock);
+}
+
+/* Acquires INODE's lock, which makes a sequence of reads and
+   writes of the inode atomic with respect to other threads that
+   also use it, such as the lookup and update in adding an entry
+   to a directory.  Plain reads and writes do not need it. */
+void
+inode_lock (struct inode *inode)
+{
+  lock_acquire (&inode->lock);
+}
+
+/* Releases INODE's lock. */
+void
+inode_unlock (struct inode *inode)
+{
+  lock_release (&inode->lock);
+}
+
+/* Starts reading the data of INODE from byte offset POS, which
+   must be at the start of a sector, into the cache in the
+   background, as one run of up to READ_AHEAD_RUN sectors that
+   are consecutive on disk. */
+static void
+read_ahead (struct inode *inode, off_t pos)
+{
+  block_sector_t start = 0;
+  size_t cnt;
+
+  for (cnt = 0; cnt < READ_AHEAD_RUN; cnt++, pos += BLOCK_SECTOR_SIZE)
+    {
+      block_sector_t sector;
+
+      if (pos >= inode->data.length)
+        break;
+      sector = byte_to_sector (&inode->data, pos, false, NULL);
+      if (cnt == 0)
+        start = sector;
+      if (sector == 0 || sector != start + cnt)
+        break;
+    }
+
+  if (cnt > 0)
+    cache_read_ahead (start, cnt);
 }
 
 /* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
    Returns the number of bytes actually read, which may be less
-   than SIZE if an error occurs or end of file is reached. */
+   than SIZE if an error occurs or end of file is reached.
+   A read that continues where the last one ended also starts
+   reading the next sector in the background. */
 off_t
 inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) 
 {
   uint8_t *buffer = buffer_;
   off_t bytes_read = 0;
-  uint8_t *bounce = NULL;
+  bool sequential;
+  block_sector_t sector_idx;
 
+  rwlock_acquire_read (&inode->rwlock);
+
+  /* NEXT_READ is shared by readers holding the lock together, so
+     it is only a hint: it is read and written once, as a single
+     word, and a race at worst misjudges whether to read ahead. */
+  sequential = offset == inode->next_read;
   while (size > 0) 
     {
       /* Disk sector to read, starting byte offset within sector. */
-      block_sector_t sector_idx = byte_to_sector (inode, offset);
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
 
       /* Bytes left in inode, bytes left in sector, lesser of the two. */
-      off_t inode_left = inode_length (inode) - offset;
+      off_t inode_left = inode->data.length - offset;
       int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
       int min_left = inode_left < sector_left ? inode_left : sector_left;
 
@@ -220,99 +553,80 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
       if (chunk_size <= 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
-        {
-          /* Read full sector directly into caller's buffer. */
-          block_read (fs_device, sector_idx, buffer + bytes_read);
-        }
-      else 
-        {
-          /* Read sector into bounce buffer, then partially copy
-             into caller's buffer. */
-          if (bounce == NULL) 
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
-          block_read (fs_device, sector_idx, bounce);
-          memcpy (buffer + bytes_read, bounce + sector_ofs, chunk_size);
-        }
+      /* A sector that was never written reads as zeros. */
+      sector_idx = byte_to_sector (&inode->data, offset, false, NULL);
+      if (sector_idx != 0)
+        cache_read_at (sector_idx, buffer + bytes_read, sector_ofs,
+                       chunk_size);
+      else
+        memset (buffer + bytes_read, 0, chunk_size);
       
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_read += chunk_size;
     }
-  free (bounce);
+  inode->next_read = offset;
+
+  if (sequential && bytes_read > 0)
+    read_ahead (inode, ROUND_UP (offset, BLOCK_SECTOR_SIZE));
+  rwlock_release_read (&inode->rwlock);
 
   return bytes_read;
 }
 
 /* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
+   A write past end of file extends the inode, so that any gap
+   before OFFSET reads as zeros.  Within the extents the gap is
+   allocated too, past them only the sectors written are.
    Returns the number of bytes actually written, which may be
-   less than SIZE if end of file is reached or an error occurs.
-   (Normally a write at end of file would extend the inode, but
-   growth is not yet implemented.) */
+   less than SIZE if the disk is full, the file would become too
+   large or an error occurs. */
 off_t
 inode_write_at (struct inode *inode, const void *buffer_, off_t size,
                 off_t offset) 
 {
   const uint8_t *buffer = buffer_;
   off_t bytes_written = 0;
-  uint8_t *bounce = NULL;
+  bool changed = false;
 
+  rwlock_acquire_write (&inode->rwlock);
   if (inode->deny_write_cnt)
-    return 0;
+    size = 0;
 
   while (size > 0) 
     {
-      /* Sector to write, starting byte offset within sector. */
-      block_sector_t sector_idx = byte_to_sector (inode, offset);
+      /* Sector to write, allocated if necessary, starting byte
+         offset within sector. */
+      block_sector_t sector_idx = byte_to_sector (&inode->data, offset, true,
+                                                  &changed);
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
 
-      /* Bytes left in inode, bytes left in sector, lesser of the two. */
-      off_t inode_left = inode_length (inode) - offset;
-      int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
-      int min_left = inode_left < sector_left ? inode_left : sector_left;
-
       /* Number of bytes to actually write into this sector. */
-      int chunk_size = size < min_left ? size : min_left;
-      if (chunk_size <= 0)
+      int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
+      int chunk_size = size < sector_left ? size : sector_left;
+      if (sector_idx == 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
-        {
-          /* Write full sector directly to disk. */
-          block_write (fs_device, sector_idx, buffer + bytes_written);
-        }
-      else 
-        {
-          /* We need a bounce buffer. */
-          if (bounce == NULL) 
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
-
-          /* If the sector contains data before or after the chunk
-             we're writing, then we need to read in the sector
-             first.  Otherwise we start with a sector of all zeros. */
-          if (sector_ofs > 0 || chunk_size < sector_left) 
-            block_read (fs_device, sector_idx, bounce);
-          else
-            memset (bounce, 0, BLOCK_SECTOR_SIZE);
-          memcpy (bounce + sector_ofs, buffer + bytes_written, chunk_size);
-          block_write (fs_device, sector_idx, bounce);
-        }
+      /* The cache reads in the rest of a partially written
+         sector. */
+      cache_write_at (sector_idx, buffer + bytes_written, sector_ofs,
+                      chunk_size);
 
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_written += chunk_size;
     }
-  free (bounce);
+
+  if (bytes_written > 0 && offset > inode->data.length)
+    {
+      inode->data.length = offset;
+      changed = true;
+    }
+  if (changed)
+    cache_write (inode->sector, &inode->data);
+  rwlock_release_write (&inode->rwlock);
 
   return bytes_written;
 }
@@ -322,8 +636,10 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 void
 inode_deny_write (struct inode *inode) 
 {
+  rwlock_acquire_write (&inode->rwlock);
   inode->deny_write_cnt++;
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
+  rwlock_release_write (&inode->rwlock);
 }
 
 /* Re-enables writes to INODE.
@@ -332,12 +648,15 @@ inode_deny_write (struct inode *inode)
 void
 inode_allow_write (struct inode *inode) 
 {
+  rwlock_acquire_write (&inode->rwlock);
   ASSERT (inode->deny_write_cnt > 0);
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
   inode->deny_write_cnt--;
+  rwlock_release_write (&inode->rwlock);
 }
 
-/* Returns the length, in bytes, of INODE's data. */
+/* Returns the length, in bytes, of INODE's data.
+   The length is a single word, so it is read without the lock. */
 off_t
 inode_length (const struct inode *inode)
 {
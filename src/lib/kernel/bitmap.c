@@ -69,6 +69,27 @@ last_mask (const struct bitmap *b)
   return last_bits ? ((elem_type) 1 << last_bits) - 1 : (elem_type) -1;
 }
 
+/* Returns element ELEM of B with a 1 in each position whose bit
+   is set to VALUE.  Positions past
+   the end of B are always 0. */
+static inline elem_type
+match_elem (const struct bitmap *b, size_t elem, bool value)
+{
+  elem_type bits = value ? b->bits[elem] : ~b->bits[elem];
+  if (elem == elem_cnt (b->bit_cnt) - 1)
+    bits &= last_mask (b);
+  return bits;
+}
+
+/* Returns the index of the lowest 1 bit in BITS, which must be
+   nonzero. */
+static inline size_t
+lowest_set_bit (elem_type bits)
+{
+  ASSERT (bits != 0);
+  return __builtin_ctzl (bits);
+}
+
 /* Creation and destruction. */
 
 /* Initializes B to be a bitmap of BIT_CNT bits
@@ -292,20 +313,49 @@ bitmap_all (const struct bitmap *b, size_t start, size_t cnt)
 /* Finds and returns the starting index of the first group of CNT
    consecutive bits in B at or after START that are all set to
    VALUE.
-   If there is no such group, returns BITMAP_ERROR. */
+   If there is no such group, returns BITMAP_ERROR.
+
+   Works an element at a time: elements with no bit set to VALUE
+   are skipped with a single compare, and runs within an element
+   are measured by counting trailing zeros. */
 size_t
 bitmap_scan (const struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
+  size_t run = 0;               /* Length of the run ending before I. */
+  size_t i = start;
+
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
 
-  if (cnt <= b->bit_cnt) 
+  if (cnt > b->bit_cnt - start)
+    return BITMAP_ERROR;
+  if (cnt == 0)
+    return start;
+
+  while (i < b->bit_cnt)
     {
-      size_t last = b->bit_cnt - cnt;
-      size_t i;
-      for (i = start; i <= last; i++)
-        if (!bitmap_contains (b, i, cnt, !value))
-          return i; 
+      size_t ofs = i % ELEM_BITS;
+      size_t left = ELEM_BITS - ofs;
+      elem_type bits = match_elem (b, elem_idx (i), value) >> ofs;
+
+      if (bits & 1)
+        {
+          /* Bits from I onward match up to the first zero. */
+          size_t ones = ~bits != 0 ? lowest_set_bit (~bits) : left;
+          if (ones > left)
+            ones = left;
+          if (run + ones >= cnt)
+            return i - run;
+          run += ones;
+          i += ones;
+        }
+      else
+        {
+          /* The run is broken; skip to the next matching bit,
+             or past the element if there is none. */
+          run = 0;
+          i += bits != 0 ? lowest_set_bit (bits) : left;
+        }
     }
   return BITMAP_ERROR;
 }
@@ -325,7 +375,31 @@ bitmap_scan_and_flip (struct bitmap *b, size_t start, size_t cnt, bool value)
     bitmap_set_multiple (b, idx, cnt, !value);
   return idx;
 }
-
+
+/* Next-fit variant of bitmap_scan_and_flip().  Searches B for a
+   group of CNT consecutive bits set to VALUE starting at *CURSOR
+   and wrapping around to the beginning of B, flips them all to
+   !VALUE, and advances *CURSOR past the group so that the next
+   search resumes where this one ended.
+   Returns the index of the first bit in the group, or
+   BITMAP_ERROR if there is no such group. */
+size_t
+bitmap_scan_and_flip_next (struct bitmap *b, size_t *cursor, size_t cnt,
+                           bool value)
+{
+  size_t start = *cursor <= b->bit_cnt ? *cursor : 0;
+  size_t idx = bitmap_scan (b, start, cnt, value);
+
+  if (idx == BITMAP_ERROR && start > 0)
+    idx = bitmap_scan (b, 0, cnt, value);
+  if (idx != BITMAP_ERROR)
+    {
+      bitmap_set_multiple (b, idx, cnt, !value);
+      *cursor = idx + cnt < b->bit_cnt ? idx + cnt : 0;
+    }
+  return idx;
+}
+
 /* File input and output. */
 
 #ifdef FILESYS
@@ -22,6 +22,9 @@ enum
     /* Task 3 and optionally task 4. */
     SYS_MMAP,                   /* Map a file into memory. */
     SYS_MUNMAP,                 /* Remove a memory mapping. */
+    SYS_MSYNC,                  /* Write a memory mapping back to its file. */
+    SYS_MADVISE,                /* Advise how a range of memory is used. */
+    SYS_RSSLIMIT,               /* Limit the process's resident pages. */
 
     /* Task 4 only. */
     SYS_CHDIR,                  /* Change the current directory. */
@@ -31,4 +34,14 @@ enum
     SYS_INUMBER                 /* Returns the inode number for a fd. */
   };
 
+/* Advice for SYS_MADVISE. */
+enum
+  {
+    MADV_NORMAL,                /* No special treatment. */
+    MADV_SEQUENTIAL,            /* Read ahead eagerly, evict behind. */
+    MADV_RANDOM,                /* Do not read ahead. */
+    MADV_WILLNEED,              /* Load the pages now. */
+    MADV_DONTNEED               /* Drop the pages and their contents. */
+  };
+
 #endif /* lib/syscall-nr.h */
@@ -153,6 +153,24 @@ munmap (mapid_t mapid)
   syscall1 (SYS_MUNMAP, mapid);
 }
 
+bool
+msync (mapid_t mapid, unsigned offset, unsigned length)
+{
+  return syscall3 (SYS_MSYNC, mapid, offset, length);
+}
+
+bool
+madvise (void *addr, size_t length, int advice)
+{
+  return syscall3 (SYS_MADVISE, addr, length, advice);
+}
+
+size_t
+rsslimit (size_t pages)
+{
+  return syscall1 (SYS_RSSLIMIT, pages);
+}
+
 bool
 chdir (const char *dir)
 {
@@ -3,6 +3,8 @@
 
 #include <stdbool.h>
 #include <debug.h>
+#include <stddef.h>
+#include <syscall-nr.h>
 
 /* Process identifier. */
 typedef int pid_t;
@@ -37,6 +39,9 @@ void close (int fd);
 /* Task 3 and optionally task 4. */
 mapid_t mmap (int fd, void *addr);
 void munmap (mapid_t);
+bool msync (mapid_t, unsigned offset, unsigned length);
+bool madvise (void *addr, size_t length, int advice);
+size_t rsslimit (size_t pages);
 
 /* Task 4 only. */
 bool chdir (const char *dir);
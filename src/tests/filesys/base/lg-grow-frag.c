@@ -0,0 +1,60 @@
+/* Grows a file sequentially, one fixed-size block at a time,
+   creating a small file after each block so that the file
+   cannot grow in place and needs a new extent for every block.
+   The file outgrows its extents, so its later sectors go
+   through the indirect and doubly indirect index sectors.
+   Reads it back to verify that it was written properly, then
+   removes the small files and verifies it again. */
+
+#include <stdio.h>
+#include <syscall.h>
+#include "tests/filesys/seq-test.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define TEST_SIZE 200000
+#define BLOCK_SIZE 1234
+#define SMALL_SIZE 512
+
+static char buf[TEST_SIZE];
+static int small_cnt;
+
+static size_t
+return_block_size (void) 
+{
+  return BLOCK_SIZE;
+}
+
+static void
+check_size_and_fragment (int fd, long ofs) 
+{
+  char name[16];
+  long size = filesize (fd);
+  if (size != ofs)
+    fail ("filesize not updated properly: should be %ld, actually %ld",
+          ofs, size);
+
+  snprintf (name, sizeof name, "small%d", small_cnt++);
+  if (!create (name, SMALL_SIZE))
+    fail ("create \"%s\" failed", name);
+}
+
+void
+test_main (void) 
+{
+  char name[16];
+  int i;
+
+  seq_test ("testfile",
+            buf, sizeof buf, 0,
+            return_block_size, check_size_and_fragment);
+
+  msg ("removing small files");
+  for (i = 0; i < small_cnt; i++)
+    {
+      snprintf (name, sizeof name, "small%d", i);
+      if (!remove (name))
+        fail ("remove \"%s\" failed", name);
+    }
+  check_file ("testfile", buf, sizeof buf);
+}
@@ -0,0 +1,20 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(lg-grow-frag) begin
+(lg-grow-frag) create "testfile"
+(lg-grow-frag) open "testfile"
+(lg-grow-frag) writing "testfile"
+(lg-grow-frag) close "testfile"
+(lg-grow-frag) open "testfile" for verification
+(lg-grow-frag) verified contents of "testfile"
+(lg-grow-frag) close "testfile"
+(lg-grow-frag) removing small files
+(lg-grow-frag) open "testfile" for verification
+(lg-grow-frag) verified contents of "testfile"
+(lg-grow-frag) close "testfile"
+(lg-grow-frag) end
+EOF
+pass;
@@ -0,0 +1,16 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(lg-grow-seq) begin
+(lg-grow-seq) create "testfile"
+(lg-grow-seq) open "testfile"
+(lg-grow-seq) writing "testfile"
+(lg-grow-seq) close "testfile"
+(lg-grow-seq) open "testfile" for verification
+(lg-grow-seq) verified contents of "testfile"
+(lg-grow-seq) close "testfile"
+(lg-grow-seq) end
+EOF
+pass;
@@ -0,0 +1,150 @@
+/* Test program for scanning in lib/kernel/bitmap.c.
+
+   Checks bitmap_scan() and bitmap_scan_and_flip_next() against a
+   bit-at-a-time reference on random bitmaps, then times both on
+   a nearly full bitmap, which is the case the page, swap and
+   sector allocators hit when memory or disk is short.
+
+   This is not a test we will run on your submitted tasks.
+   It is here for completeness.
+*/
+
+#undef NDEBUG
+#include <bitmap.h>
+#include <debug.h>
+#include <random.h>
+#include <stdio.h>
+#include "devices/timer.h"
+#include "threads/test.h"
+
+/* Maximum number of bits in a bitmap that we will test. */
+#define MAX_BITS 1024
+
+/* Bits in the bitmap used for timing and the number of scans. */
+#define BENCH_BITS 8192
+#define BENCH_SCANS 200
+
+static size_t reference_scan (const struct bitmap *, size_t start,
+                              size_t cnt, bool value);
+static void verify_scan (const struct bitmap *, size_t cnt, bool value);
+static void fill_random (struct bitmap *, int density);
+static void benchmark (void);
+
+/* Test bitmap scanning. */
+void
+test (void)
+{
+  size_t bit_cnt;
+
+  printf ("testing various size bitmaps:");
+  for (bit_cnt = 1; bit_cnt <= MAX_BITS; bit_cnt = bit_cnt * 3 / 2 + 1)
+    {
+      struct bitmap *b = bitmap_create (bit_cnt);
+      int density;
+
+      ASSERT (b != NULL);
+      printf (" %zu", bit_cnt);
+      for (density = 0; density <= 100; density += 10)
+        {
+          size_t cnt;
+
+          fill_random (b, density);
+          for (cnt = 0; cnt <= 40 && cnt <= bit_cnt; cnt++)
+            {
+              verify_scan (b, cnt, false);
+              verify_scan (b, cnt, true);
+            }
+        }
+
+      /* Next-fit allocation must hand out every bit exactly once
+         before failing, wrapping around as it goes. */
+      {
+        size_t cursor = bit_cnt / 2;
+        size_t i;
+
+        bitmap_set_all (b, false);
+        for (i = 0; i < bit_cnt; i++)
+          ASSERT (bitmap_scan_and_flip_next (b, &cursor, 1, false)
+                  == (bit_cnt / 2 + i) % bit_cnt);
+        ASSERT (bitmap_scan_and_flip_next (b, &cursor, 1, false)
+                == BITMAP_ERROR);
+        ASSERT (bitmap_all (b, 0, bit_cnt));
+      }
+
+      bitmap_destroy (b);
+    }
+  printf (" done\n");
+
+  benchmark ();
+  printf ("bitmap: PASS\n");
+}
+
+/* Bit-at-a-time equivalent of bitmap_scan(), as it used to be
+   implemented. */
+static size_t
+reference_scan (const struct bitmap *b, size_t start, size_t cnt, bool value)
+{
+  size_t bit_cnt = bitmap_size (b);
+
+  if (cnt <= bit_cnt)
+    {
+      size_t last = bit_cnt - cnt;
+      size_t i;
+      for (i = start; i <= last; i++)
+        if (!bitmap_contains (b, i, cnt, !value))
+          return i;
+    }
+  return BITMAP_ERROR;
+}
+
+/* Checks bitmap_scan() against reference_scan() from every start
+   index in B. */
+static void
+verify_scan (const struct bitmap *b, size_t cnt, bool value)
+{
+  size_t start;
+
+  for (start = 0; start <= bitmap_size (b); start++)
+    ASSERT (bitmap_scan (b, start, cnt, value)
+            == reference_scan (b, start, cnt, value));
+}
+
+/* Sets each bit in B to true with probability DENSITY percent. */
+static void
+fill_random (struct bitmap *b, int density)
+{
+  size_t i;
+
+  for (i = 0; i < bitmap_size (b); i++)
+    bitmap_set (b, i, (int) (random_ulong () % 100) < density);
+}
+
+/* Times both scans looking for a 2-bit hole at the very end of an
+   otherwise full bitmap. */
+static void
+benchmark (void)
+{
+  struct bitmap *b = bitmap_create (BENCH_BITS);
+  int64_t start;
+  int64_t reference_ticks, scan_ticks;
+  int i;
+
+  ASSERT (b != NULL);
+  bitmap_set_all (b, true);
+  bitmap_set_multiple (b, BENCH_BITS - 2, 2, false);
+
+  start = timer_ticks ();
+  for (i = 0; i < BENCH_SCANS; i++)
+    ASSERT (reference_scan (b, 0, 2, false) == BENCH_BITS - 2);
+  reference_ticks = timer_elapsed (start);
+
+  start = timer_ticks ();
+  for (i = 0; i < BENCH_SCANS; i++)
+    ASSERT (bitmap_scan (b, 0, 2, false) == BENCH_BITS - 2);
+  scan_ticks = timer_elapsed (start);
+
+  printf ("%d scans of a nearly full %d-bit bitmap: "
+          "%"PRId64" ticks bit at a time, %"PRId64" ticks word at a time\n",
+          BENCH_SCANS, BENCH_BITS, reference_ticks, scan_ticks);
+  bitmap_destroy (b);
+}
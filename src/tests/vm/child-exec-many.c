@@ -0,0 +1,13 @@
+/* Child process of page-exec-many.
+   Does nothing but exit, so that the run time of the parent is
+   dominated by loading and tearing down shared code pages. */
+
+#include "tests/lib.h"
+
+const char *test_name = "child-exec-many";
+
+int
+main (void)
+{
+  return 0x37;
+}
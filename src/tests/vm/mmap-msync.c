@@ -0,0 +1,38 @@
+/* Writes to a file through a mapping, syncs the mapping with
+   msync, then reads the data in the file back through a
+   separate handle before unmapping to verify that msync wrote
+   it. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/vm/sample.inc"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define ACTUAL ((void *) 0x10000000)
+
+void
+test_main (void)
+{
+  int handle, handle2;
+  mapid_t map;
+  char buf[1024];
+
+  /* Write file via mmap and sync it. */
+  CHECK (create ("sample.txt", strlen (sample)), "create \"sample.txt\"");
+  CHECK ((handle = open ("sample.txt")) > 1, "open \"sample.txt\"");
+  CHECK ((map = mmap (handle, ACTUAL)) != MAP_FAILED, "mmap \"sample.txt\"");
+  memcpy (ACTUAL, sample, strlen (sample));
+  CHECK (msync (map, 0, strlen (sample)), "msync \"sample.txt\"");
+  CHECK (!msync (map + 1, 0, strlen (sample)), "msync bad mapping");
+
+  /* Read back via read() while still mapped. */
+  CHECK ((handle2 = open ("sample.txt")) > 1, "open \"sample.txt\" again");
+  read (handle2, buf, strlen (sample));
+  CHECK (!memcmp (buf, sample, strlen (sample)),
+         "compare read data against written data");
+  close (handle2);
+
+  munmap (map);
+  close (handle);
+}
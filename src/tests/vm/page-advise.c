@@ -0,0 +1,48 @@
+/* Gives each kind of advice to memory with madvise and checks
+   that contents are kept or dropped as the advice says: dropped
+   anonymous pages read back as zeroes, while dropped pages of a
+   mapping are written back to the file first. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/vm/sample.inc"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define ACTUAL ((void *) 0x10000000)
+#define PAGE_SIZE 4096
+
+static char buf[4 * PAGE_SIZE] __attribute__ ((aligned (PAGE_SIZE)));
+
+void
+test_main (void)
+{
+  int handle;
+  mapid_t map;
+  size_t i;
+
+  /* Anonymous memory. */
+  memset (buf, 0x5a, sizeof buf);
+  CHECK (madvise (buf, sizeof buf, MADV_DONTNEED), "drop buffer");
+  for (i = 0; i < sizeof buf; i++)
+    if (buf[i] != 0)
+      fail ("byte %zu of dropped buffer is %d, not zero", i, buf[i]);
+  msg ("dropped buffer reads as zeroes");
+
+  /* Mapped file. */
+  CHECK ((handle = open ("sample.txt")) > 1, "open \"sample.txt\"");
+  CHECK ((map = mmap (handle, ACTUAL)) != MAP_FAILED, "mmap \"sample.txt\"");
+  CHECK (madvise (ACTUAL, PAGE_SIZE, MADV_SEQUENTIAL), "advise sequential");
+  CHECK (madvise (ACTUAL, PAGE_SIZE, MADV_WILLNEED), "advise willneed");
+  CHECK (!memcmp (ACTUAL, sample, strlen (sample)),
+         "compare mapping against sample");
+  memcpy (ACTUAL, "ADVISE", 6);
+  CHECK (madvise (ACTUAL, PAGE_SIZE, MADV_DONTNEED), "drop mapping");
+  CHECK (!memcmp (ACTUAL, "ADVISE", 6), "mapping kept its write");
+  munmap (map);
+  close (handle);
+
+  /* Bad arguments. */
+  CHECK (!madvise (buf + 1, PAGE_SIZE, MADV_NORMAL), "unaligned address");
+  CHECK (!madvise (buf, PAGE_SIZE, 42), "unknown advice");
+}
@@ -0,0 +1,20 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(page-advise) begin
+(page-advise) drop buffer
+(page-advise) dropped buffer reads as zeroes
+(page-advise) open "sample.txt"
+(page-advise) mmap "sample.txt"
+(page-advise) advise sequential
+(page-advise) advise willneed
+(page-advise) compare mapping against sample
+(page-advise) drop mapping
+(page-advise) mapping kept its write
+(page-advise) unaligned address
+(page-advise) unknown advice
+(page-advise) end
+EOF
+pass;
@@ -0,0 +1,26 @@
+/* Runs 32 copies of child-exec-many at once and waits for them
+   all, so that every copy shares the same read-only code frames
+   and the frames are released again as the children exit. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define CHILD_CNT 32
+
+void
+test_main (void)
+{
+  pid_t children[CHILD_CNT];
+  int i;
+
+  for (i = 0; i < CHILD_CNT; i++)
+    if ((children[i] = exec ("child-exec-many")) == PID_ERROR)
+      fail ("exec \"child-exec-many\" %d", i);
+  msg ("exec %d copies of \"child-exec-many\"", CHILD_CNT);
+
+  for (i = 0; i < CHILD_CNT; i++)
+    if (wait (children[i]) != 0x37)
+      fail ("wait for child %d", i);
+  msg ("wait for %d children", CHILD_CNT);
+}
@@ -0,0 +1,11 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(page-exec-many) begin
+(page-exec-many) exec 32 copies of "child-exec-many"
+(page-exec-many) wait for 32 children
+(page-exec-many) end
+EOF
+pass;
@@ -0,0 +1,55 @@
+/* Limits the process to fewer resident pages than it touches,
+   then writes and verifies a buffer twice the size of the limit,
+   so that the process has to replace its own pages.  Then asks
+   for a limit too small to run an instruction within, which must
+   be raised to a usable floor rather than livelock, and repeats
+   the passes, and finally asks for one larger than memory, which
+   must be capped. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define LIMIT 32
+#define TINY_LIMIT 1
+#define HUGE_LIMIT ((size_t) -1)
+#define PAGE_SIZE 4096
+#define SIZE (2 * LIMIT * PAGE_SIZE)
+
+static char buf[SIZE];
+
+/* Writes every byte of BUF, then reads every byte back. */
+static void
+write_and_verify (void)
+{
+  size_t i;
+
+  msg ("write pass");
+  for (i = 0; i < SIZE; i++)
+    buf[i] = i % 251;
+
+  msg ("read pass");
+  for (i = 0; i < SIZE; i++)
+    if (buf[i] != (char) (i % 251))
+      fail ("byte %zu != %d", i, (int) (i % 251));
+}
+
+void
+test_main (void)
+{
+  size_t floor;
+
+  CHECK (rsslimit (LIMIT) > 0, "set resident limit");
+  CHECK (rsslimit (0) == LIMIT, "resident limit kept");
+  write_and_verify ();
+  CHECK (rsslimit (0) == LIMIT, "resident limit unchanged");
+
+  CHECK (rsslimit (TINY_LIMIT) == LIMIT, "set tiny resident limit");
+  floor = rsslimit (0);
+  CHECK (floor > TINY_LIMIT && floor <= LIMIT,
+         "tiny resident limit raised to a floor");
+  write_and_verify ();
+
+  CHECK (rsslimit (HUGE_LIMIT) == floor, "set huge resident limit");
+  CHECK (rsslimit (0) < HUGE_LIMIT, "huge resident limit capped");
+}
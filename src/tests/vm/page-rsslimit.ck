@@ -0,0 +1,20 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(page-rsslimit) begin
+(page-rsslimit) set resident limit
+(page-rsslimit) resident limit kept
+(page-rsslimit) write pass
+(page-rsslimit) read pass
+(page-rsslimit) resident limit unchanged
+(page-rsslimit) set tiny resident limit
+(page-rsslimit) tiny resident limit raised to a floor
+(page-rsslimit) write pass
+(page-rsslimit) read pass
+(page-rsslimit) set huge resident limit
+(page-rsslimit) huge resident limit capped
+(page-rsslimit) end
+EOF
+pass;
@@ -33,6 +33,8 @@
 #include "userprog/tss.h"
 #include "vm/frame.h"
 #include "vm/swap.h"
+#include "vm/pageout.h"
+#include "vm/zswap.h"
 #else
 #include "tests/threads/tests.h"
 #endif
@@ -62,6 +64,19 @@ static const char *swap_bdev_name;
 /* -ul: Maximum number of pages to put into palloc's user pool. */
 static size_t user_page_limit = SIZE_MAX;
 
+/* -rss: Resident pages above which a process replaces its own. */
+static size_t resident_limit = SIZE_MAX;
+
+#ifdef VM
+/* -lwm, -hwm: Free user pages below which the page-out daemon wakes
+   and up to which it reclaims. */
+static size_t pageout_low = SIZE_MAX;
+static size_t pageout_high = SIZE_MAX;
+
+/* -zs: Pages of memory for the compressed swap cache, 0 to disable it. */
+static size_t zswap_pages = 0;
+#endif
+
 static void bss_init (void);
 static void paging_init (void);
 
@@ -166,9 +181,8 @@ paging_init (void)
   size_t page;
   extern char _start, _end_kernel_text;
 
-  ft_init();
+  ft_init(resident_limit);
   st_init();
-  lock_init(&allocation_lock);
   
   pd = init_page_dir = palloc_get_page (PAL_ASSERT | PAL_ZERO);
   pt = NULL;
@@ -268,6 +282,16 @@ parse_options (char **argv)
 #ifdef USERPROG
       else if (!strcmp (name, "-ul"))
         user_page_limit = atoi (value);
+      else if (!strcmp (name, "-rss"))
+        resident_limit = atoi (value);
+#endif
+#ifdef VM
+      else if (!strcmp (name, "-lwm"))
+        pageout_low = atoi (value);
+      else if (!strcmp (name, "-hwm"))
+        pageout_high = atoi (value);
+      else if (!strcmp (name, "-zs"))
+        zswap_pages = atoi (value);
 #endif
       else
         PANIC ("unknown option `%s' (use -h for help)", name);
@@ -390,6 +414,12 @@ usage (void)
           "  -mlfqs             Use multi-level feedback queue scheduler.\n"
 #ifdef USERPROG
           "  -ul=COUNT          Limit user memory to COUNT pages.\n"
+          "  -rss=COUNT         Keep up to COUNT pages of each process resident.\n"
+#endif
+#ifdef VM
+          "  -lwm=COUNT         Page out when fewer than COUNT user pages are free.\n"
+          "  -hwm=COUNT         Page out until COUNT user pages are free.\n"
+          "  -zs=COUNT          Cache compressed swap in up to COUNT pages.\n"
 #endif
           );
   shutdown_power_off ();
@@ -405,6 +435,8 @@ locate_block_devices (void)
 #ifdef VM
   locate_block_device (BLOCK_SWAP, swap_bdev_name);
   swap_init();
+  zswap_init (zswap_pages);
+  pageout_init (pageout_low, pageout_high);
 #endif
 }
 
@@ -7,6 +7,7 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include "threads/interrupt.h"
 #include "threads/loader.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
@@ -34,6 +35,8 @@ struct pool
     struct lock lock;                   /* Mutual exclusion. */
     struct bitmap *used_map;            /* Bitmap of free pages. */
     uint8_t *base;                      /* Base of pool. */
+    size_t free_cnt;                    /* Number of free pages. */
+    size_t next_fit;                    /* Page index to search from. */
   };
 
 /* Two pools: one for kernel data, one for user pages. */
@@ -42,6 +45,7 @@ static struct pool kernel_pool, user_pool;
 static void init_pool (struct pool *, void *base, size_t page_cnt,
                        const char *name);
 static bool page_from_pool (const struct pool *, void *page);
+static void pool_adjust_free_cnt (struct pool *, int delta);
 
 /* Initializes the page allocator.  At most USER_PAGE_LIMIT
    pages are put into the user pool. */
@@ -81,7 +85,10 @@ palloc_get_multiple (enum palloc_flags flags, size_t page_cnt)
     return NULL;
 
   lock_acquire (&pool->lock);
-  page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
+  page_idx = bitmap_scan_and_flip_next (pool->used_map, &pool->next_fit,
+                                        page_cnt, false);
+  if (page_idx != BITMAP_ERROR)
+    pool_adjust_free_cnt (pool, -(int) page_cnt);
   lock_release (&pool->lock);
 
   if (page_idx != BITMAP_ERROR)
@@ -143,6 +150,7 @@ palloc_free_multiple (void *pages, size_t page_cnt)
 
   ASSERT (bitmap_all (pool->used_map, page_idx, page_cnt));
   bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+  pool_adjust_free_cnt (pool, page_cnt);
 }
 
 /* Frees the page at PAGE. */
@@ -152,6 +160,24 @@ palloc_free_page (void *page)
   palloc_free_multiple (page, 1);
 }
 
+/* Stores the address of the first page of the user pool in
+   *BASE and the number of pages in it in *PAGE_CNT.  Pages from
+   the user pool are contiguous, so a page's index in the pool is
+   its offset from *BASE divided by PGSIZE. */
+void
+palloc_get_user_pool (void **base, size_t *page_cnt) 
+{
+  *base = user_pool.base;
+  *page_cnt = bitmap_size (user_pool.used_map);
+}
+
+/* Returns the number of pages currently free in the user pool. */
+size_t
+palloc_user_free_cnt (void) 
+{
+  return user_pool.free_cnt;
+}
+
 /* Initializes pool P as starting at START and ending at END,
    naming it NAME for debugging purposes. */
 static void
@@ -171,6 +197,19 @@ init_pool (struct pool *p, void *base, size_t page_cnt, const char *name)
   lock_init (&p->lock);
   p->used_map = bitmap_create_in_buf (page_cnt, base, bm_pages * PGSIZE);
   p->base = base + bm_pages * PGSIZE;
+  p->free_cnt = page_cnt;
+  p->next_fit = 0;
+}
+
+/* Adds DELTA to the free page count of POOL.  Pages can be freed
+   without holding the pool's lock, so interrupts are disabled
+   instead to keep the update atomic. */
+static void
+pool_adjust_free_cnt (struct pool *pool, int delta) 
+{
+  enum intr_level old_level = intr_disable ();
+  pool->free_cnt += delta;
+  intr_set_level (old_level);
 }
 
 /* Returns true if PAGE was allocated from POOL,
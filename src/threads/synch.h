@@ -42,6 +42,23 @@ void cond_wait (struct condition *, struct lock *);
 void cond_signal (struct condition *, struct lock *);
 void cond_broadcast (struct condition *, struct lock *);
 
+/* Readers-writer lock. */
+struct rwlock
+  {
+    struct lock lock;           /* Protects the fields below. */
+    struct condition readers;   /* Waiting readers. */
+    struct condition writers;   /* Waiting writers. */
+    unsigned reader_cnt;        /* Threads holding the lock to read. */
+    unsigned waiting_writers;   /* Threads waiting to write. */
+    bool writing;               /* True if a thread holds it to write. */
+  };
+
+void rwlock_init (struct rwlock *);
+void rwlock_acquire_read (struct rwlock *);
+void rwlock_release_read (struct rwlock *);
+void rwlock_acquire_write (struct rwlock *);
+void rwlock_release_write (struct rwlock *);
+
 /* Optimization barrier.
 
    The compiler will not reorder operations across an
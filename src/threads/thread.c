@@ -157,7 +157,10 @@ thread_tick (void)
     idle_ticks++;
 #ifdef USERPROG
   else if (t->pagedir != NULL)
-    user_ticks++;
+    {
+      user_ticks++;
+      t->virtual_ticks++;
+    }
 #endif
   else
     kernel_ticks++;
@@ -192,11 +195,6 @@ thread_tick (void)
 	next = list_next(next);
       }
     }
-
-    /* resets refrerence bits every half second */
-    if(timer_ticks() % (TIMER_FREQ * 2) == 0) {
-      ft_reset_reference_bits();
-    }
   }
   
   /* Enforce preemption. */
@@ -275,6 +273,12 @@ thread_create (const char *name, int priority,
 
   /* Initialise hash tables for the thread struct */
   spt_init(&t->sup_table);
+  t->pinned.start = t->pinned.end = NULL;
+  t->virtual_ticks = 0;
+  t->resident_cnt = 0;
+  t->resident_limit = thread_current()->pagedir != NULL
+                      ? thread_current()->resident_limit
+                      : ft_default_resident_limit();
   mmap_init(&t->mmap_table);
 
 #endif
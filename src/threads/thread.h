@@ -7,6 +7,8 @@
 #include <hash.h>
 #include "synch.h"
 #include "threads/fixed-point.h"
+#include "vm/page.h"
+#include "vm/prefetch.h"
 
 /* States in a thread's life cycle. */
 enum thread_status
@@ -140,10 +142,21 @@ struct thread
     struct list allocated_pointers;     /* List of pointers to be freed on
 					   exit */
     void *curr_esp;                     /* Current esp of last user thread */
-    struct hash sup_table;              /* Supplemental page table */
+    struct sup_table sup_table;         /* Supplemental page table */
+    struct pin_range pinned;            /* User pages pinned for the
+                                           current system call */
+    uint32_t virtual_ticks;             /* Ticks the process has run for,
+                                           its virtual time for page
+                                           replacement */
+    size_t resident_cnt;                /* User pages mapped to frames */
+    size_t resident_limit;              /* Resident pages above which the
+                                           process replaces its own */
     struct hash mmap_table;             /* Memory mapped files table */
     int next_map_id;                    /* Next available memory map id */
     int stack_page_cnt;                 /* Number of stack pages added. */
+    struct prefetch_stream prefetch[PREFETCH_STREAMS];
+                                        /* Read-ahead state of recently
+                                           faulted mappings */
 #endif
 
     /* Owned by thread.c. */
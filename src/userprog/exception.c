@@ -2,6 +2,7 @@
 #include <inttypes.h>
 #include <stdio.h>
 #include <string.h>
+#include <syscall-nr.h>
 #include "userprog/gdt.h"
 #include "userprog/process.h"
 #include "userprog/syscall.h"
@@ -15,6 +16,8 @@
 #include "vm/page.h"
 #include "vm/frame.h"
 #include "vm/swap.h"
+#include "vm/prefetch.h"
+#include "vm/advise.h"
 
 #define MAX_PUSH_SIZE (32)
 #define MAX_STACK_PAGES (1024)
@@ -29,6 +32,8 @@ static void page_fault (struct intr_frame *);
 static void exception_exit(struct intr_frame *);
 static bool file_to_frame(struct sup_table_entry *, void *);
 static void swap_to_frame(struct sup_table_entry *, void *);
+static void *get_user_page(void *, enum palloc_flags, bool, bool);
+static bool load_page(void *, void *, bool, bool, bool, bool);
 
 /* Registers handlers for interrupts that can be caused by user
    programs.
@@ -166,12 +171,24 @@ page_fault (struct intr_frame *f)
   write = (f->error_code & PF_W) != 0;
   user = (f->error_code & PF_U) != 0;
   	      
-  /* Checks for if the page fault happened in a valid case */
-  if(!not_present || !fault_addr
-     || pagedir_get_page(t->pagedir, pg_round_down(fault_addr))) {
+  /* Checks for if the page fault happened in a valid case, where the only
+     faults on present pages that can be handled are writes to pages
+     mapped to the zero frame */
+  if(!fault_addr) {
     exception_exit(f);
   }
 
+  if(not_present) {
+    if(pagedir_get_page(t->pagedir, pg_round_down(fault_addr))) {
+      exception_exit(f);
+    }
+  } else {
+    struct sup_table_entry *spt = spt_find_entry(t, fault_addr);
+    if(!write || spt == NULL || !spt->zero_mapped) {
+      exception_exit(f);
+    }
+  }
+
   /* Load a frame for the virtual address */
   if(!load_frame(fault_addr, f->esp, FAULT_ACCESS, user, write)) {
     exception_exit(f);
@@ -184,7 +201,6 @@ page_fault (struct intr_frame *f)
    and returning an error code of -1 */
 static void exception_exit(struct intr_frame *f) {
   /* Release locks that may be held */
-  run_if_false(filesys_lock_release(), !filesys_lock_held_by_current_thread());
   run_if_false(ft_lock_release(), !ft_lock_held_by_current_thread());
   run_if_false(st_lock_release(), !st_lock_held_by_current_thread());
   run_if_false(swap_lock_release(), !swap_lock_held_by_current_thread());
@@ -200,13 +216,9 @@ static void exception_exit(struct intr_frame *f) {
    and the frame table entry related to the frame 
    Returns false if more data is found than expected */
 static bool file_to_frame(struct sup_table_entry *spt, void *frame) {
-  
-  bool lock_held = filesys_lock_held_by_current_thread();
-  
-  run_if_false(filesys_lock_acquire(), lock_held);
-  file_seek(spt->file, spt->offset);
-  size_t bytes_read = file_read(spt->file, frame, spt->read_bytes);
-  run_if_false(filesys_lock_release(), lock_held);
+  /* Read at the page's own offset, as other pages share the file */
+  size_t bytes_read = file_read_at(spt->file, frame, spt->read_bytes,
+				   spt->offset);
 
   if(bytes_read > spt->read_bytes) {
     return false;
@@ -218,30 +230,58 @@ static bool file_to_frame(struct sup_table_entry *spt, void *frame) {
 
 /* Writes a page of data from the swap system to a frame 
    Takes the supplemental page table entry corresponding to the swapped data
-   and the frame table entry corresponding to the frame */
+   and the frame table entry corresponding to the frame
+   The swap slot is kept so that the page can be evicted again without
+   being rewritten unless it is dirtied first */
 static void swap_to_frame(struct sup_table_entry *spt, void *frame) {
   bool lock_held = swap_lock_held_by_current_thread();
 
+  ft_lock_acquire();
   if(spt->type == IN_SWAP_FILE) {
     spt->type = FILE_PAGE;
   }
+  ft_lock_release();
 
   run_if_false(swap_lock_acquire(), lock_held);
-  ft_pin(spt->upage, PGSIZE);
   swap_read_frame(frame, spt->block_number);
-  ft_unpin(spt->upage, PGSIZE);
-  remove_swap_space(spt->block_number, 1);
   run_if_false(swap_lock_release(), lock_held);
 }
 
+/* Allocates a frame for a page being loaded, evicting if EVICT is true
+   Returns the frame, or NULL if EVICT is false and no frame is free */
+static void *get_user_page(void *uaddr, enum palloc_flags flags,
+			   bool writable, bool evict) {
+  if(evict) {
+    return allocate_user_page(uaddr, flags, writable);
+  }
+  return try_allocate_user_page(uaddr, flags, writable);
+}
+
 /* Load a frame for a faulting/unloaded address */
 bool load_frame(void *fault_addr, void *esp, bool fault, bool user, bool write) {
+  return load_page(fault_addr, esp, fault, user, write, true);
+}
+
+/* Loads a page the kernel expects to be needed, only into a free frame,
+   never by evicting, for example on MADV_WILLNEED
+   Takes the user page to load
+   Returns false if there is no free frame or the page cannot be loaded */
+bool try_load_frame(void *upage) {
+  return load_page(upage, NULL, LOAD_ACCESS, KERNEL_ACCESS, READ_ACCESS,
+		   false);
+}
+
+/* Loads a frame for an address as load_frame(), allocating it by evicting
+   if EVICT is true or only from the free frames otherwise */
+static bool load_page(void *fault_addr, void *esp, bool fault, bool user,
+		      bool write, bool evict) {
   struct sup_table_entry *spt;           /* The entry of this address in the
 					    suplemental page table */
   struct frame_table_entry *ft;          /* The entry of this address in the
                                             frame table */
-  void *frame;                           /* The frame of physical memory the
-					    fault_addr accesses */
+  void *frame = NULL;                    /* The frame of physical memory the
+					    fault_addr accesses, if one is
+					    allocated for it here */
   struct thread *t = thread_current();   /* The current thread */
   
   /* Validity checks */
@@ -269,89 +309,122 @@ bool load_frame(void *fault_addr, void *esp, bool fault, bool user, bool write)
     return false;
   }
 
+  /* A page being evicted by another thread is only usable once written */
+  ft_wait_transit(spt);
+
   pagedir_set_accessed(spt->owner->pagedir, fault_addr, spt->accessed);
   pagedir_set_dirty(spt->owner->pagedir, fault_addr, spt->modified);
   ft = spt->ft;
+
+  if(spt->zero_mapped) {
+    if(!write) {
+      return true;
+    }
+
+    /* The first write gives the page a private frame of its own */
+    pagedir_clear_page(spt->owner->pagedir, spt->upage);
+    spt->zero_mapped = false;
+  }
   
   /* Check whether a frame_entry has already been allocated */
   if(ft == NULL) {
     /* Allocate physical memory to map to the fault_addr */
     switch(spt->type) {
-      /* Allocate a zero page */
+      /* Map the zero frame on reads, allocate a zero page on writes */
       case NEW_STACK_PAGE:
-	frame = allocate_user_page(fault_addr, PAL_ZERO, spt->writable);
+      case ZERO_PAGE:
+	if(!write) {
+	  if(!pagedir_set_page(spt->owner->pagedir, spt->upage,
+			       ft_get_zero_frame(), false)) {
+	    return false;
+	  }
+	  spt->zero_mapped = true;
+	  return true;
+	}
+	frame = get_user_page(fault_addr, PAL_ZERO, spt->writable, evict);
+	if(frame == NULL) {
+	  return false;
+	}
 	break;
 
       /* Allocate a zero page to be put the swap space on eviction */
       case IN_SWAP_FILE:	
       case STACK_PAGE:
-	frame = allocate_user_page(fault_addr, PAL_ZERO, spt->writable);
+	frame = get_user_page(fault_addr, PAL_ZERO, spt->writable, evict);
+	if(frame == NULL) {
+	  return false;
+	}
 	swap_to_frame(spt, frame);
 	break;
 
 	/* Allocate a user accessable page which, if modified, will be put in
 	   the swap space on eviction */
       case MMAPPED_PAGE:
-	frame = allocate_user_page(fault_addr, PAL_USER, spt->writable);
+	frame = get_user_page(fault_addr, PAL_USER, spt->writable, evict);
+	if(frame == NULL) {
+	  return false;
+	}
 	if(spt->modified) {
 	  swap_to_frame(spt, frame);
 	} else {
 	  if(!file_to_frame(spt, frame)) {
 	    return false;
 	  }
+	  prefetch_around(spt);
 	}
 	break;
 
-      /* Allocate a user accessable file or zero page which will be put in the swap 
-	 space on eviction if writable */
-      case ZERO_PAGE:
+      /* Allocate a user accessable file page which will be put in the swap 
+	 space on eviction if writable, or shared with the other processes
+	 running the same executable if read only */
       case FILE_PAGE:
-	if(spt->writable) {
-	  frame = allocate_user_page(fault_addr, PAL_USER, spt->writable);
-	  if(!file_to_frame(spt, frame)) {
-	    return false;
-	  }
+	if(!spt->writable && install_shared_page(spt)) {
 	  break;
 	}
 
-	bool lock_held = st_lock_held_by_current_thread();
-	
-	run_if_false(st_lock_acquire(), lock_held);
-	struct shared_table_entry *st = st_find_entry(spt->file, spt->offset);
-	run_if_false(st_lock_release(), lock_held);
-	
-	if (st != NULL) {
-	  install_shared_page(st, spt);
-	} else {
-	  frame = allocate_user_page(fault_addr, PAL_USER, spt->writable);
-	  if(!file_to_frame(spt, frame)) {
-	    return false;
-	  }
+	frame = get_user_page(fault_addr, PAL_USER, spt->writable, evict);
+	if(frame == NULL) {
+	  return false;
+	}
+	if(!file_to_frame(spt, frame)) {
+	  return false;
 	}
+	if(!spt->writable) {
+	  share_page(spt);
+	}
+	prefetch_around(spt);
 	break;
 
       default:
 	return false;
     }
-    
+
+    /* A scan through sequentially advised pages evicts behind itself */
+    if(spt->advice == MADV_SEQUENTIAL) {
+      advise_drop_behind(spt);
+    }
   }
 
-  lock_acquire(&spt->ft->owners_lock);
-  if(list_empty(&spt->ft->owners)) {
-    lock_release(&spt->ft->owners_lock);
-    return false;
+  ft_lock_acquire();
+  if(spt->ft == NULL) {
+    /* Evicted again by another thread already, so let the access fault
+       again */
+    ft_lock_release();
+    return true;
+  }
+
+  /* A frame allocated here was pinned until its data was loaded */
+  if(frame != NULL) {
+    spt->ft->pinned = false;
   }
     
   struct sup_table_entry *spt_entry;
-  struct list_elem *spt_elem = list_front(&spt->ft->owners);
-  while(spt_elem != list_end(&spt->ft->owners)) {
-    spt_entry = list_entry(spt_elem, struct sup_table_entry, frame_elem);
+  for(spt_entry = spt->ft->owners; spt_entry != NULL;
+      spt_entry = spt_entry->next_owner) {
     spt_entry->accessed = true;
-      
-    spt_elem = list_next(spt_elem);
   }
 
-  lock_release(&spt->ft->owners_lock);
+  ft_lock_release();
 
   return true;
 }
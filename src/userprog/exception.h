@@ -25,6 +25,7 @@ void exception_init (void);
 void exception_print_stats (void);
 
 bool load_frame(void *, void *, bool, bool, bool);
+bool try_load_frame(void *);
 struct sup_table_entry *grow_stack(void *, struct sup_table_entry *);
 
 #endif /* userprog/exception.h */
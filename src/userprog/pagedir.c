@@ -7,8 +7,6 @@
 #include "threads/pte.h"
 #include "threads/palloc.h"
 #include "threads/malloc.h"
-#include "vm/frame.h"
-#include "vm/page.h"
 
 static uint32_t *active_pd (void);
 static void invalidate_pagedir (uint32_t *);
@@ -26,8 +24,9 @@ pagedir_create (void)
   return pd;
 }
 
-/* Destroys page directory PD, freeing all the pages it
-   references. */
+/* Destroys page directory PD.  The user pages it references
+   belong to the frame table and must already have been released
+   by spt_destroy(). */
 void
 pagedir_destroy (uint32_t *pd) 
 {
@@ -41,21 +40,8 @@ pagedir_destroy (uint32_t *pd)
     if (*pde & PTE_P) 
       {
         uint32_t *pt = pde_get_pt (*pde);
-        uint32_t *pte;
-        
-        for (pte = pt; pte < pt + PGSIZE / sizeof *pte; pte++)
-          if (*pte & PTE_P) { 
-            struct sup_table_entry *spt =
-		    spt_find_entry(thread_current(), pte);
-	    
-	    if(spt != NULL && list_size(&spt->ft->owners) <= 1) {
-	      palloc_free_page (pte_get_page (*pte));
-	    }
-	  }
         palloc_free_page (pt);
       }
-  /* Frees supplemental page table and all other corresponding table entries */
-  spt_destroy(&thread_current()->sup_table);
   palloc_free_page (pd);
 }
 
@@ -28,6 +28,7 @@
 #include "vm/page.h"
 #include "vm/mmap.h"
 #include "vm/swap.h"
+#include "vm/pageout.h"
 
 static thread_func start_process NO_RETURN;
 static bool load (const char *cmdline, void (**eip) (void), void **esp);
@@ -323,6 +324,10 @@ process_exit (void)
   /* Destroy mmap table */
   mmap_destroy(&t->mmap_table);
 
+  /* Release every frame and swap slot held by the process while its
+     page directory and executable are still valid */
+  spt_destroy(&t->sup_table);
+
   /* Frees all memory associated with open files */
   struct list_elem *current;
   struct file_elem *current_file;
@@ -378,9 +383,7 @@ process_exit (void)
       }
 
       /* Close processe's executable (will allow write) */
-      filesys_lock_acquire();
       file_close(t->executable);
-      filesys_lock_release();
 
       /* Correct ordering here is crucial.  We must set
          cur->pagedir to NULL before switching page directories,
@@ -502,9 +505,7 @@ load (const char *file_name, void (**eip) (void), void **esp)
   process_activate ();
   
   /* Open executable file. */
-  filesys_lock_acquire();
   file = filesys_open (file_name);
-  filesys_lock_release();
     
   if (file == NULL) 
     {
@@ -514,9 +515,7 @@ load (const char *file_name, void (**eip) (void), void **esp)
 
   /* Save processe's executable file to executable and deny write to it */
   t->executable = file;
-  filesys_lock_acquire();
   file_deny_write(file);
-  filesys_lock_release();
 
   /* Read and verify executable header. */
   if (file_read (file, &ehdr, sizeof ehdr) != sizeof ehdr
@@ -607,6 +606,8 @@ load (const char *file_name, void (**eip) (void), void **esp)
 /* load() helpers. */
 
 static bool install_page (void *upage, void *kpage, bool writable);
+static void *map_user_page(void *uaddr, void *kpage, bool writable);
+static void *evict_user_page(enum palloc_flags flags, struct thread *owner);
 
 /* Checks whether PHDR describes a valid, loadable segment in
    FILE and returns true if so, false otherwise. */
@@ -683,9 +684,7 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
       size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
       size_t page_zero_bytes = PGSIZE - page_read_bytes;
 
-      filesys_lock_acquire();
       file_seek (file, ofs);
-      filesys_lock_release();
       
       enum sup_entry_type page_type = page_zero_bytes == PGSIZE
 	? ZERO_PAGE : FILE_PAGE;
@@ -719,6 +718,10 @@ setup_stack (void **esp)
   if (kpage == NULL) {
     return false;
   }
+
+  ft_lock_acquire();
+  ft_find_entry(kpage)->pinned = false;
+  ft_lock_release();
   
   *esp = PHYS_BASE;
   
@@ -746,190 +749,194 @@ install_page (void *upage, void *kpage, bool writable)
           && pagedir_set_page (t->pagedir, upage, kpage, writable));
 }
 
-/* Installs a shared read only executable file page into an existing frame 
-   Takes the shared pages table and supplemental page table entries 
+/* Installs a shared read only executable file page into the frame that
+   already holds it for another process, if there is one
+   The lookup, the new owner and the mapping are all made under the frame
+   table lock, which the evictor needs to remove the shared entry, so that
+   the frame cannot be freed and reused in between
+   Takes the supplemental page table entry of the page
+   Returns false if the page is not shared
    Exits if the page cannot be installed */
-void install_shared_page(struct shared_table_entry *st,
-			 struct sup_table_entry *spt) {
-  struct frame_table_entry *ft = st->ft;
+bool install_shared_page(struct sup_table_entry *spt) {
+  struct shared_table_entry *st;
+  struct frame_table_entry *ft;
 
-  lock_acquire(&ft->owners_lock);
-  list_push_back(&ft->owners, &spt->frame_elem);
-  lock_release(&ft->owners_lock);
-  spt->ft = ft;
-  bool success = install_page(spt->upage, ft->frame, false);
+  ft_lock_acquire();
+  st_lock_acquire();
+  st = st_find_entry(spt->file, spt->offset);
+  st_lock_release();
 
-  if (!success) {
+  if(st == NULL) {
+    ft_lock_release();
+    return false;
+  }
+
+  ft = st->ft;
+  if(!install_page(spt->upage, ft_get_frame(ft), false)) {
+    ft_lock_release();
     thread_exit();
   }
+  ft_add_owner(ft, spt);
+  spt->ft = ft;
+  ft_lock_release();
+
+  return true;
+}
+
+/* Makes a read only executable file page that has just been read into its
+   frame available to other processes running the same executable
+   It is only published once read, so that nobody maps it half read, and
+   not at all if the page is already shared from another frame or there is
+   no memory for the entry
+   Takes the supplemental page table entry of the page */
+void share_page(struct sup_table_entry *spt) {
+  struct shared_table_entry *st = malloc(sizeof(struct shared_table_entry));
+
+  if(st == NULL) {
+    return;
+  }
+  st_set_key(st, spt->file, spt->offset);
+
+  ft_lock_acquire();
+  st_lock_acquire();
+  if(spt->ft != NULL && spt->ft->st == NULL
+     && st_find_entry(spt->file, spt->offset) == NULL) {
+    st->ft = spt->ft;
+    spt->ft->st = st;
+    st_insert_entry(&st->elem);
+    st = NULL;
+  }
+  st_lock_release();
+  ft_lock_release();
+
+  free(st);
+}
+
+/* Evicts a batch of frames, reusing the first for a new page and returning
+   the rest to the user pool
+   A process replacing its own pages evicts just the one it needs, as the
+   rest of a batch would cost it working set and writes only to be handed
+   to other processes through the pool
+   Takes extra palloc flags for the page and the process to evict only the
+   frames of, or NULL for any process
+   Returns the frame to reuse or NULL if none could be evicted */
+static void *evict_user_page(enum palloc_flags flags, struct thread *owner) {
+  void *kpages[EVICT_BATCH];
+  size_t cnt = ft_evict_frames(kpages, owner != NULL ? 1 : EVICT_BATCH,
+			       owner);
+
+  if(cnt == 0) {
+    return NULL;
+  }
+
+  for(size_t i = 1; i < cnt; i++) {
+    palloc_free_page(kpages[i]);
+  }
+
+  if(flags & PAL_ZERO) {
+    memset(kpages[0], 0, PGSIZE);
+  }
+  return kpages[0];
 }
 
 /* Allocates a user page and installs it into the frame table 
    takes a user address to allocate space for, extra palloc flags and whether
    the file is writable or not 
-   Returns the address of the frame allocated or null if out of pages */
+   A process at its resident limit replaces one of its own pages, so that it
+   cannot push other processes' working sets out of memory. Otherwise, or
+   if all of its pages are pinned, frames are evicted from any process if
+   the user pool is empty, and the process exits if none can be
+   Returns the address of the frame allocated */
 void *allocate_user_page (void* uaddr, enum palloc_flags flags, bool writable) {
   struct thread *t = thread_current();
-  uaddr = pg_round_down(uaddr);
- 
-  struct sup_table_entry *spt;
-  struct frame_table_entry *ft;
-  
-  void *kpage = palloc_get_page(PAL_USER | flags);
+  void *kpage = NULL;
 
-  if(kpage != NULL) {
-    /* Allocation successful, adds frame to table */
-    create_alloc_elem(kpage, PALLOC_PTR);
-    bool success = install_page(uaddr, kpage, writable);
-    
-    if(!success) {
-      remove_alloc_elem(kpage);
-      palloc_free_page(kpage);
-      thread_exit();
-    }
-    
-    /* Create and initialise new frame table entry */
-    ft = malloc(sizeof(struct frame_table_entry));
-    if(ft == NULL) {
-      remove_alloc_elem(kpage);
-      palloc_free_page(kpage);
-      thread_exit(); 
-    }
-    create_alloc_elem(ft, MALLOC_PTR);
-       
-    ft->frame = kpage;
-    ft->timestamp = timer_ticks();
-    ft->reference_bit = 0;
-    ft->modified = 0;
-    ft->writable = writable;
-   
-    spt = spt_find_entry(t, uaddr);
-
-    if(spt == NULL) {
+  if(t->resident_cnt >= t->resident_limit) {
+    kpage = evict_user_page(flags, t);
+  }
+
+  if(kpage == NULL) {
+    kpage = palloc_get_page(PAL_USER | flags);
+  }
+
+  if(kpage == NULL) {
+    kpage = evict_user_page(flags, NULL);
+
+    if(kpage == NULL) {
       thread_exit();
     }
+  }
 
-    ft->pinned = spt->pinned;
-    
-    /* Initialises new objects in the frame table */
-    lock_init(&ft->owners_lock);    
-    list_init(&ft->owners);
+  return map_user_page(uaddr, kpage, writable);
+}
 
-    /* Adds supplemental page table entry into owners list */
-    lock_acquire(&ft->owners_lock);
-    list_push_back(&ft->owners, &spt->frame_elem);
-    lock_release(&ft->owners_lock);
+/* Allocates a user page from the free frames only and installs it into the
+   frame table, as allocate_user_page() but without ever evicting
+   Returns the address of the frame allocated or NULL if there are no free
+   frames or the process is at its resident limit */
+void *try_allocate_user_page(void *uaddr, enum palloc_flags flags,
+			     bool writable) {
+  struct thread *t = thread_current();
 
-    ft_lock_acquire();
-    ft_insert_entry(&ft->elem);
-    ft_lock_release();
-    
-    remove_alloc_elem(ft);
-    remove_alloc_elem(kpage);
-  } else {
-    /* Allocation fails, frame is evicted and has its metadata replaced */
+  if(t->resident_cnt >= t->resident_limit) {
+    return NULL;
+  }
 
-    lock_acquire(&allocation_lock);
+  void *kpage = palloc_get_page(PAL_USER | flags);
 
-    ft_lock_acquire();
-    ft = ft_get_victim();
-    ft_lock_release();
+  if(kpage == NULL) {
+    return NULL;
+  }
+  return map_user_page(uaddr, kpage, writable);
+}
 
-    ASSERT(ft != NULL);
-    /* For all owners pagedir_clear_page and update spt
-       and put the page into swap or filesys */
-    struct list_elem *e;
-
-    lock_acquire(&ft->owners_lock);
-    if(ft->writable) {
-      /* Get the frame's owner (only has one owner as writable) */
-      e = list_pop_front(&ft->owners);
-      spt = list_entry(e, struct sup_table_entry, frame_elem);
-
-      if((pagedir_is_dirty(spt->owner->pagedir, spt->upage)) || spt->modified) {
-        /* Put frame data in swap system */
-        swap_lock_acquire();
-        size_t start = find_swap_space(1);
-
-        if (start == BITMAP_ERROR) {
-          lock_release(&ft->owners_lock);
-          swap_lock_release();
-          thread_exit();
-        }
-	
-	ft_pin(uaddr, PGSIZE);
-        swap_write_frame(ft->frame, start);
-	ft_unpin(uaddr, PGSIZE);
-        swap_lock_release();
-        spt->block_number = start;
-
-        /* Indicate file is in swap system if it is a file page */
-        if(spt->type == ZERO_PAGE || spt->type == FILE_PAGE) {
-          spt->type = IN_SWAP_FILE;
-        }
-        spt->modified = true;
-	spt->ft = NULL;
-      }
-    } else {
-      /* Remove each owner of the frame and remove the shared table entry */
-      e = list_pop_front(&ft->owners);
-      spt = list_entry(e, struct sup_table_entry, frame_elem);
-      st_remove_entry(spt->file, spt->offset);
-      while(!list_empty(&ft->owners)) {
-	pagedir_clear_page(spt->owner->pagedir, spt->upage);
-	spt->ft = NULL;
-        e = list_pop_front(&ft->owners);
-        spt = list_entry(e, struct sup_table_entry, frame_elem);
-      }
-    }
-    lock_release(&ft->owners_lock);
-
-    /* Update frame metadata to reflect new page */
-    spt = spt_find_entry(t, uaddr);
-    list_push_back(&ft->owners, &spt->frame_elem);
-    ft->reference_bit = 1;
-    ft->writable = spt->writable;
-    ft->modified = spt->modified;
-
-    memset(ft->frame, 0, PGSIZE);
-
-    kpage = ft->frame;
-    bool success = install_page(spt->upage, kpage, spt->writable);
-    if (!success) {
-      palloc_free_page(kpage);
-      PANIC("Evicted installaton fails");
-    }
+/* Maps a newly allocated user frame at uaddr and makes its page the owner
+   of the frame in the frame table
+   The frame is left pinned, for the caller to unpin once it is loaded
+   Takes the user address, the frame and whether it is writable
+   Returns the frame */
+static void *map_user_page(void *uaddr, void *kpage, bool writable) {
+  struct thread *t = thread_current();
+  uaddr = pg_round_down(uaddr);
+
+  struct sup_table_entry *spt;
+  struct frame_table_entry *ft;
+
+  /* Let the page-out daemon refill the pool before it runs dry */
+  pageout_check();
 
-    lock_release(&allocation_lock);
+  /* Adds frame to table */
+  create_alloc_elem(kpage, PALLOC_PTR);
+  bool success = install_page(uaddr, kpage, writable);
+    
+  if(!success) {
+    remove_alloc_elem(kpage);
+    palloc_free_page(kpage);
+    thread_exit();
   }
-  
+    
+  spt = spt_find_entry(t, uaddr);
 
-  /* Sets loaded page's frame table to the found frame table */
+  if(spt == NULL) {
+    thread_exit();
+  }
+
+  /* Start using the frame's table entry with the page as its owner, pinned
+     so that it is not evicted before the caller has loaded its data */
+  ft_lock_acquire();
+  ft = ft_insert_entry(kpage, writable);
+  ft_add_owner(ft, spt);
+  ft->reference_bit = true;
+  ft->pinned = true;
   spt->ft = ft;
-  ft->pinned = spt->pinned;
 
-  /* Updates type if new stack page loaded, 
-     adds shared table entry for read only files */
+  /* Updates type if new stack page loaded */
   if(spt->type == NEW_STACK_PAGE) {
     spt->type = STACK_PAGE;
-  } else if (spt->type == FILE_PAGE && !writable) {
-    struct shared_table_entry *st = malloc(sizeof(struct shared_table_entry));
-    if (st == NULL) {
-      thread_exit();
-    }
-    create_alloc_elem(st, MALLOC_PTR);
-    
-    st->ft = ft;
-    st->file = spt->file;
-    st->offset = spt->offset;
-    
-    st_lock_acquire();
-    st_insert_entry(&st->elem);
-    st_lock_release();
-    remove_alloc_elem(st);
-
   }
+  ft_lock_release();
     
+  remove_alloc_elem(kpage);
 
   return kpage;
 }
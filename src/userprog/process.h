@@ -23,8 +23,10 @@ void process_exit (void);
 void process_activate (void);
 
 /* Managing frame and shared tables */
-void install_shared_page(struct shared_table_entry *, struct sup_table_entry *);
+bool install_shared_page(struct sup_table_entry *);
+void share_page(struct sup_table_entry *);
 void *allocate_user_page (void *, enum palloc_flags, bool);
+void *try_allocate_user_page (void *, enum palloc_flags, bool);
 
 /* Manipulate the thread's allocated_pointers list */
 void create_alloc_elem(void *, bool);
@@ -15,7 +15,9 @@
 #include "devices/shutdown.h"
 #include "devices/input.h"
 #include "vm/page.h"
+#include "vm/frame.h"
 #include "vm/mmap.h"
+#include "vm/advise.h"
 
 static void syscall_handler (struct intr_frame *);
 
@@ -35,18 +37,23 @@ static void syscall_tell(struct intr_frame *f);
 static void syscall_close(struct intr_frame *f);
 static void syscall_mmap(struct intr_frame *f);
 static void syscall_munmap(struct intr_frame *f);
+static void syscall_msync(struct intr_frame *f);
+static void syscall_madvise(struct intr_frame *f);
+static void syscall_rsslimit(struct intr_frame *f);
 
 /* MEMORY ACCESS FUNCTION */
 static void syscall_access_memory(void *vaddr);
 static void syscall_access_block(void *block, unsigned size);
 static void syscall_access_string(char *str);
-static bool check_filename(char *name);
+static bool copy_filename(const char *name, char *buffer);
 
 
 /* HELPER FUNCTIONS */
 static void *get_argument(void *esp, int arg_no);
 static void return_value_to_frame(struct intr_frame *f, uint32_t val);
 static struct file_elem* get_file(struct thread *t, int fd);
+static int transfer_pinned(struct file *file, uint8_t *buffer, unsigned size,
+			   void *esp, bool read);
 
 /* Jump table used to call a syscall */
 static syscall_func syscalls[MAX_SYSCALLS] = {&syscall_halt, &syscall_exit,
@@ -56,14 +63,12 @@ static syscall_func syscalls[MAX_SYSCALLS] = {&syscall_halt, &syscall_exit,
 					      &syscall_read, &syscall_write,
 					      &syscall_seek, &syscall_tell,
 					      &syscall_close, &syscall_mmap,
-					      &syscall_munmap};
-
-/* Lock used to control access to file system */
-static struct lock filesys_lock;
+					      &syscall_munmap, &syscall_msync,
+					      &syscall_madvise, &syscall_rsslimit};
 
 void syscall_init(void) {
   intr_register_int (0x30, 3, INTR_ON, syscall_handler, "syscall");
-  lock_init(&filesys_lock);
+  mmap_sync_init();
 }
 
 static void syscall_handler(struct intr_frame *f) {
@@ -130,12 +135,11 @@ static void syscall_wait(struct intr_frame *f) {
 static void syscall_create(struct intr_frame *f) {
   char *name = GET_ARGUMENT_VALUE(f, char *, 1);
   uint32_t initial_size = GET_ARGUMENT_VALUE(f, uint32_t, 2);
+  char kname[NAME_MAX + 1];
   bool res = false;
   
-  if(check_filename(name)) {
-    lock_acquire(&filesys_lock);
-    res = filesys_create(name, (off_t) initial_size); 
-    lock_release(&filesys_lock);
+  if(copy_filename(name, kname)) {
+    res = filesys_create(kname, (off_t) initial_size);
   }
   
   return_value_to_frame(f, (uint32_t) res);
@@ -146,12 +150,11 @@ static void syscall_create(struct intr_frame *f) {
    Returns boolean stating whether file was successfully deleted */
 static void syscall_remove(struct intr_frame *f) {
   char *name = GET_ARGUMENT_VALUE(f, char *, 1);
+  char kname[NAME_MAX + 1];
   bool res = false;
   
-  if(check_filename(name)) {
-    lock_acquire(&filesys_lock);
-    res = filesys_remove(name);
-    lock_release(&filesys_lock);
+  if(copy_filename(name, kname)) {
+    res = filesys_remove(kname);
   }
   
   return_value_to_frame(f, (uint32_t) res);
@@ -162,11 +165,11 @@ static void syscall_remove(struct intr_frame *f) {
    Returns the fd of the file or -1 if unsuccessful */
 static void syscall_open(struct intr_frame *f) {
   char *name = GET_ARGUMENT_VALUE(f, char *, 1);
+  char kname[NAME_MAX + 1];
   int fd = ERROR_CODE;
 
-  if(check_filename(name)) {
-    lock_acquire(&filesys_lock);
-    struct file *file = filesys_open(name);
+  if(copy_filename(name, kname)) {
+    struct file *file = filesys_open(kname);
     
     if(file != NULL) {
       struct thread *t = thread_current();
@@ -175,7 +178,6 @@ static void syscall_open(struct intr_frame *f) {
 
       /* If process runs out of memory, kill it */
       if(current_file == NULL) {
-	lock_release(&filesys_lock);
 	thread_exit();
       }
       create_alloc_elem(current_file, MALLOC_PTR);
@@ -189,7 +191,6 @@ static void syscall_open(struct intr_frame *f) {
       list_push_back(&t->files, &current_file->elem);
       remove_alloc_elem(current_file);
     } 
-    lock_release(&filesys_lock);
   }
   
   return_value_to_frame(f, (uint32_t) fd);  
@@ -208,9 +209,7 @@ static void syscall_filesize(struct intr_frame *f) {
 
   /* If a file is found, get its size */
   if(file != NULL) {
-    lock_acquire(&filesys_lock);
     filesize = file_length(file->file);
-    lock_release(&filesys_lock);
   }
   
   return_value_to_frame(f, (uint32_t) filesize);
@@ -246,13 +245,7 @@ static void syscall_read(struct intr_frame *f) {
   } else {
     struct file_elem *file = get_file(t, fd);
     if(file != NULL) {
-      ft_pin(buffer, size);
-      if(load_frame(buffer, f->esp, LOAD_ACCESS, USER_ACCESS, NULL)) {
-	lock_acquire(&filesys_lock);
-	bytes_read = (int) file_read(file->file, buffer, (off_t) size);
-	lock_release(&filesys_lock);
-      }
-      ft_unpin(buffer, size);
+      bytes_read = transfer_pinned(file->file, buffer, size, f->esp, true);
     }
   }
 
@@ -283,13 +276,8 @@ static void syscall_write(struct intr_frame *f) {
     struct file_elem *file_elem = get_file(t, fd);
 
     if (file_elem != NULL) {
-      ft_pin(buffer, size);
-      if(load_frame(buffer, f->esp, LOAD_ACCESS, USER_ACCESS, NULL)) {
-	lock_acquire(&filesys_lock);
-	bytes_written = file_write(file_elem->file, buffer, (off_t) size);
-	lock_release(&filesys_lock);
-      }
-      ft_pin(buffer, size);
+      bytes_written = transfer_pinned(file_elem->file, buffer, size, f->esp,
+				      false);
     }
   }
   
@@ -308,9 +296,7 @@ static void syscall_seek(struct intr_frame *f) {
 
   /* If a file is found, set its position to the position argument */
   if(file != NULL) {
-    lock_acquire(&filesys_lock);
     file_seek(file->file, (off_t) position);
-    lock_release(&filesys_lock);
   }
 }
 
@@ -328,9 +314,7 @@ static void syscall_tell(struct intr_frame *f) {
 
   /* If a file is found, get next byte to be read */
   if(file != NULL) {
-    lock_acquire(&filesys_lock);
     position = (unsigned) file_tell(file->file);
-    lock_release(&filesys_lock);
   }
   
   return_value_to_frame(f, (uint32_t) position);
@@ -346,9 +330,7 @@ static void syscall_close(struct intr_frame *f) {
   struct file_elem *file = get_file(t, fd);
   
   if(file != NULL) {
-    lock_acquire(&filesys_lock);
     file_close(file->file);
-    lock_release(&filesys_lock);
     
     /* Remove file_elem struct from list of files and
        free allocated memory */
@@ -377,14 +359,19 @@ static void syscall_mmap(struct intr_frame *f) {
 
     if(file != NULL) {
       /* Obtain new file reference for a mapping */
-      filesys_lock_acquire();
       struct file *file_ref = file_reopen(file->file);
       off_t length = file_length(file_ref);
-      filesys_lock_release();
+      struct mmap_entry *mmap = NULL;
 
       /* Check file is not empty */
       if(length != 0) {
         map_id = mmap_create_entry(file_ref, addr);
+	mmap = mmap_find_entry(map_id);
+      }
+
+      if(mmap == NULL) {
+	file_close(file_ref);
+	length = 0;
       }
 
       size_t page_read_bytes;
@@ -392,22 +379,28 @@ static void syscall_mmap(struct intr_frame *f) {
       while(length > 0) {
         page_read_bytes = length < PGSIZE ? length : PGSIZE;
 
-	filesys_lock_acquire();
 	file_seek(file_ref, ofs);
-	filesys_lock_release();
 
         if(!create_file_page(addr, file_ref, ofs, true, page_read_bytes,
 			     MMAPPED_PAGE)) {
-	  struct mmap_entry *mmap = mmap_find_entry(map_id);		     
 	  mmap_remove_entry(mmap, false);
 	  map_id = ERROR_CODE;
 	  break;
 	}
 
+	/* Unmapping removes exactly the pages counted here */
+	mmap->page_cnt++;
+
         length -= page_read_bytes;
 	ofs += PGSIZE;
         addr += PGSIZE;
       }
+
+      /* Let the mapping be synced once all of its pages exist */
+      if(map_id != (mapid_t) ERROR_CODE && !mmap_track_pages(map_id)) {
+	mmap_remove_entry(mmap_find_entry(map_id), false);
+	map_id = ERROR_CODE;
+      }
     }
   }
 
@@ -421,6 +414,53 @@ static void syscall_munmap(struct intr_frame *f) {
   mmap_remove_entry(mmap, false);
 }
 
+/* Writes the dirty pages of part of a mapping back to its file;
+   Takes in the map id and the offset and length in bytes of the part of
+   the mapping to write back;
+   Returns true if successful, false if the map id or offset is invalid */
+static void syscall_msync(struct intr_frame *f) {
+  mapid_t map_id = GET_ARGUMENT_VALUE(f, mapid_t, 1);
+  unsigned offset = GET_ARGUMENT_VALUE(f, unsigned, 2);
+  unsigned length = GET_ARGUMENT_VALUE(f, unsigned, 3);
+
+  struct mmap_entry *mmap = mmap_find_entry(map_id);
+  bool success = mmap != NULL && mmap_sync(mmap, offset, length);
+
+  return_value_to_frame(f, (uint32_t) success);
+}
+
+/* Advises how a range of the process's memory will be used;
+   Takes in the page aligned start of the range, its length in bytes and
+   one of the MADV_ values;
+   Returns true if successful, false if the range or advice is invalid */
+static void syscall_madvise(struct intr_frame *f) {
+  void *addr = GET_ARGUMENT_VALUE(f, void *, 1);
+  size_t length = GET_ARGUMENT_VALUE(f, size_t, 2);
+  int advice = GET_ARGUMENT_VALUE(f, int, 3);
+
+  bool success = advise_range(addr, length, advice);
+
+  return_value_to_frame(f, (uint32_t) success);
+}
+
+/* Limits the number of pages the process keeps resident, which processes
+   it executes afterwards inherit;
+   Takes in the new limit in pages, or 0 to leave the limit unchanged,
+   raised to a floor the process can run within and capped at the user
+   pool;
+   Returns the limit before the call */
+static void syscall_rsslimit(struct intr_frame *f) {
+  size_t pages = GET_ARGUMENT_VALUE(f, size_t, 1);
+  struct thread *t = thread_current();
+  size_t old_limit = t->resident_limit;
+
+  if(pages != 0) {
+    t->resident_limit = ft_clamp_resident_limit(pages);
+  }
+
+  return_value_to_frame(f, (uint32_t) old_limit);
+}
+
 /* MEMORY ACCESS FUNCTION */
 /* Checks validity of any user supplied pointer
    A valid pointer is one that is in user space and on an allocated page */
@@ -445,15 +485,20 @@ static void syscall_access_block(void *block, unsigned size) {
   syscall_access_memory(block + size);
 }
 
-/* Checks validity and length of a filename */
-static bool check_filename(char *name) {
-  char *curr = name;
+/* Checks validity and length of a filename and copies it into a kernel
+   buffer, so that the file system never reads user memory, which may
+   fault, while it holds a directory's lock;
+   Takes the user's name and a buffer of NAME_MAX + 1 bytes;
+   Returns false if the name is too long;
+   Can kill the thread if the name is not in valid user memory */
+static bool copy_filename(const char *name, char *buffer) {
   int i = 0;
   
   do {
-    syscall_access_memory(curr);
+    syscall_access_memory((void *) (name + i));
+    buffer[i] = name[i];
     i++;
-  } while(*(curr++) != '\0' && i < NAME_MAX);
+  } while(buffer[i - 1] != '\0' && i < NAME_MAX);
 
   /* File name is too long and will break the file system */
   if(i == NAME_MAX) {
@@ -516,14 +561,36 @@ static struct file_elem* get_file(struct thread *t, int fd) {
   return NULL; 
 }
 
-void filesys_lock_acquire(void) {
-  lock_acquire(&filesys_lock);
-}
+/* Reads a file into a user buffer, or writes the buffer to it, in chunks
+   of at most PIN_CHUNK_PAGES pages, pinning each chunk only while it is
+   transferred so that a large buffer cannot pin down every frame
+   Takes the file, the buffer and its size, the user stack pointer for
+   stack growth and whether the file is read into the buffer
+   Returns the number of bytes transferred, stopping at the first short
+   transfer */
+static int transfer_pinned(struct file *file, uint8_t *buffer, unsigned size,
+			   void *esp, bool read) {
+  unsigned done = 0;
+
+  while(done < size) {
+    uint8_t *chunk = buffer + done;
+    unsigned chunk_size = PIN_CHUNK_PAGES * PGSIZE - pg_ofs(chunk);
+    if(chunk_size > size - done) {
+      chunk_size = size - done;
+    }
 
-void filesys_lock_release(void) {
-  lock_release(&filesys_lock);
-}
+    struct pin_range *pin = ft_pin_range(chunk, chunk_size, esp,
+					 read ? WRITE_ACCESS : READ_ACCESS);
+    off_t transferred = read
+      ? file_read(file, chunk, (off_t) chunk_size)
+      : file_write(file, chunk, (off_t) chunk_size);
+    ft_unpin_range(pin);
+
+    done += transferred;
+    if((unsigned) transferred < chunk_size) {
+      break;
+    }
+  }
 
-bool filesys_lock_held_by_current_thread(void) {
-  return lock_held_by_current_thread(&filesys_lock);
+  return (int) done;
 }
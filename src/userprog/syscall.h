@@ -5,9 +5,12 @@
 #include "filesys/file.h"
 
 /* The number of implemented and working system calls in the syscall table */
-#define MAX_SYSCALLS (15)
+#define MAX_SYSCALLS (18)
 #define ERROR_CODE (-1)
 
+/* The most pages of a read or write buffer pinned at once */
+#define PIN_CHUNK_PAGES (8)
+
 /* Takes the value of the argument pointer provided by get_argument */
 #define GET_ARGUMENT_VALUE(frame, type, no)	\
   *((type *) get_argument(frame->esp, no))
@@ -26,9 +29,4 @@ struct file_elem {
 
 void syscall_init (void);
 
-/* Used to access the files lock outside of syscall */
-void filesys_lock_acquire(void);
-void filesys_lock_release(void);
-bool filesys_lock_held_by_current_thread(void);
-
 #endif /* userprog/syscall.h */
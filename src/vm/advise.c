@@ -0,0 +1,191 @@
+#include "vm/advise.h"
+#include <debug.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <syscall-nr.h>
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/exception.h"
+#include "userprog/pagedir.h"
+#include "vm/frame.h"
+#include "vm/mmap.h"
+#include "vm/page.h"
+#include "vm/prefetch.h"
+#include "vm/swap.h"
+
+/* Pages just behind a sequential fault that are left alone, and how many
+   pages behind them are made the next to be evicted */
+#define DROP_DISTANCE (16)
+#define DROP_WINDOW (16)
+
+/* Advice statistics */
+static long long willneed_cnt;
+static long long dontneed_cnt;
+static long long drop_behind_cnt;
+
+static void advise_willneed(struct sup_table_entry *);
+static void advise_dontneed(struct sup_table_entry *);
+
+/* Applies advice to every page of the current process in a range
+   SEQUENTIAL, RANDOM and NORMAL are remembered by each page and change how
+   it is read ahead and evicted, WILLNEED and DONTNEED act on the pages
+   straight away. Pages of the range that do not exist are skipped
+   Takes the page aligned start of the range, its length in bytes and the
+   advice
+   Returns false if the range is not in user memory or the advice is
+   unknown */
+bool advise_range(void *addr, size_t length, int advice) {
+  struct thread *t = thread_current();
+
+  if(pg_ofs(addr) != 0 || advice < MADV_NORMAL || advice > MADV_DONTNEED) {
+    return false;
+  }
+
+  if(length == 0) {
+    return true;
+  }
+
+  if((uintptr_t) addr + length < (uintptr_t) addr
+     || !is_user_vaddr(addr + length - 1)) {
+    return false;
+  }
+
+  void *end = addr + length;
+  for(void *upage = addr; upage < end; upage += PGSIZE) {
+    struct sup_table_entry *spt = spt_find_entry(t, upage);
+
+    if(spt == NULL) {
+      continue;
+    }
+
+    switch(advice) {
+      case MADV_NORMAL:
+      case MADV_SEQUENTIAL:
+      case MADV_RANDOM:
+	spt->advice = advice;
+	break;
+
+      case MADV_WILLNEED:
+	advise_willneed(spt);
+	break;
+
+      case MADV_DONTNEED:
+	advise_dontneed(spt);
+	break;
+    }
+  }
+
+  return true;
+}
+
+/* Loads a page that has contents to read, from its file or swap, if there
+   is a free frame for it and the process is below its resident limit
+   Never evicts, as the pages are only expected to be needed, and a process
+   at its limit would replace its own working set. Pages read from files
+   are read ahead as on a fault */
+static void advise_willneed(struct sup_table_entry *spt) {
+  if(spt->ft != NULL || spt->type == ZERO_PAGE
+     || spt->type == NEW_STACK_PAGE) {
+    return;
+  }
+
+  if(try_load_frame(spt->upage)) {
+    willneed_cnt++;
+  }
+}
+
+/* Drops a page's frame and swap slot
+   Memory mapped pages are written back to their file first, so they read
+   the same afterwards. Other pages lose their contents, reading as zeroes
+   or as their file again, as if they had never been touched
+   Pinned frames are left alone */
+static void advise_dontneed(struct sup_table_entry *spt) {
+  uint32_t *pd = spt->owner->pagedir;
+
+  if(spt->type == MMAPPED_PAGE) {
+    mmap_write_page(spt);
+  }
+
+  if(spt->zero_mapped) {
+    pagedir_clear_page(pd, spt->upage);
+    spt->zero_mapped = false;
+  }
+
+  ft_lock_acquire();
+  ft_wait_transit(spt);
+  struct frame_table_entry *ft = spt->ft;
+
+  if(ft != NULL) {
+    if(ft->pinned) {
+      ft_lock_release();
+      return;
+    }
+
+    prefetch_account(spt, pagedir_is_accessed(pd, spt->upage));
+    pagedir_clear_page(pd, spt->upage);
+    ft_remove_owner(ft, spt);
+    spt->ft = NULL;
+
+    if(ft->owners == NULL) {
+      ft_remove_entry(ft_get_frame(ft));
+    }
+  }
+
+  if(spt->in_swap) {
+    swap_lock_acquire();
+    remove_swap_space(spt->block_number, 1);
+    swap_lock_release();
+    spt->in_swap = false;
+  }
+  spt->modified = false;
+  spt->accessed = false;
+
+  if(spt->type == STACK_PAGE) {
+    spt->type = NEW_STACK_PAGE;
+  } else if(spt->type == IN_SWAP_FILE) {
+    spt->type = spt->read_bytes == 0 ? ZERO_PAGE : FILE_PAGE;
+  }
+  ft_lock_release();
+
+  dontneed_cnt++;
+}
+
+/* Makes the pages some way behind a fault on a sequentially advised page
+   the next to be evicted, as if they had not been used for a while, so
+   that a scan
+   through a large range does not push out memory that is still in use
+   Takes the supplemental page table entry of the faulting page */
+void advise_drop_behind(struct sup_table_entry *spt) {
+  struct thread *t = spt->owner;
+  uint32_t *pd = t->pagedir;
+  size_t page_no = pg_no(spt->upage);
+
+  if(page_no < DROP_DISTANCE + DROP_WINDOW) {
+    return;
+  }
+
+  ft_lock_acquire();
+  for(size_t i = DROP_DISTANCE; i < DROP_DISTANCE + DROP_WINDOW; i++) {
+    void *upage = spt->upage - i * PGSIZE;
+    struct sup_table_entry *behind = spt_find_entry(t, upage);
+
+    if(behind == NULL || behind->ft == NULL || behind->ft->st != NULL
+       || behind->advice != MADV_SEQUENTIAL) {
+      continue;
+    }
+
+    if(pagedir_is_accessed(pd, upage)) {
+      pagedir_set_accessed(pd, upage, false);
+      prefetch_account(behind, true);
+    }
+    ft_deactivate(behind->ft);
+    drop_behind_cnt++;
+  }
+  ft_lock_release();
+}
+
+/* Prints advice statistics */
+void advise_print_stats(void) {
+  printf("Advice: %lld pages loaded, %lld dropped, %lld dropped behind\n",
+	 willneed_cnt, dontneed_cnt, drop_behind_cnt);
+}
@@ -0,0 +1,13 @@
+#ifndef VM_ADVISE
+#define VM_ADVISE
+
+#include <stdbool.h>
+#include <stddef.h>
+
+struct sup_table_entry;
+
+bool advise_range(void *, size_t, int);
+void advise_drop_behind(struct sup_table_entry *);
+void advise_print_stats(void);
+
+#endif
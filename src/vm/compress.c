@@ -0,0 +1,125 @@
+#include "vm/compress.h"
+#include <debug.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "threads/vaddr.h"
+
+/* A small LZ77 compressor for whole pages
+   The output is a sequence of runs, each starting with a control byte c:
+   c < 0x80:  c + 1 literal bytes follow
+   c >= 0x80: copy (c & 0x7f) + MIN_MATCH bytes from offset + 1 bytes back,
+              where the offset follows as two little endian bytes */
+#define MAX_LITERALS (0x80)
+#define MIN_MATCH (3)
+#define MAX_MATCH (0x7f + MIN_MATCH)
+#define MAX_OFFSET (PGSIZE)
+
+/* Last position in the page at which each 3 byte hash was seen
+   Entries left over from an earlier page are harmless as every candidate
+   is checked against the data before it is used */
+#define HASH_BITS (12)
+static uint16_t hash_table[1 << HASH_BITS];
+
+/* Hashes the 3 bytes at p */
+static inline unsigned hash3(const uint8_t *p) {
+  uint32_t v = p[0] | (p[1] << 8) | (p[2] << 16);
+  return (v * 2654435761u) >> (32 - HASH_BITS);
+}
+
+/* Appends src[start, end) to dst at *op as literal runs
+   Returns false if that would take the output past limit */
+static bool emit_literals(const uint8_t *src, size_t start, size_t end,
+			  uint8_t *dst, size_t *op, size_t limit) {
+  while(start < end) {
+    size_t n = end - start < MAX_LITERALS ? end - start : MAX_LITERALS;
+
+    if(*op + 1 + n > limit) {
+      return false;
+    }
+
+    dst[(*op)++] = n - 1;
+    memcpy(dst + *op, src + start, n);
+    *op += n;
+    start += n;
+  }
+  return true;
+}
+
+/* Compresses the page at src into dst, writing at most limit bytes
+   Returns the compressed size, or 0 if the page does not fit in limit
+   Uses a static hash table, so callers must not compress concurrently */
+size_t compress_page(const void *src_, void *dst_, size_t limit) {
+  const uint8_t *src = src_;
+  uint8_t *dst = dst_;
+  size_t ip = 0, op = 0, lit_start = 0;
+
+  while(ip + MIN_MATCH <= PGSIZE) {
+    unsigned h = hash3(src + ip);
+    size_t cand = hash_table[h];
+    hash_table[h] = ip;
+
+    if(cand < ip && ip - cand <= MAX_OFFSET
+       && src[cand] == src[ip] && src[cand + 1] == src[ip + 1]
+       && src[cand + 2] == src[ip + 2]) {
+      size_t len = MIN_MATCH;
+      while(len < MAX_MATCH && ip + len < PGSIZE
+	    && src[cand + len] == src[ip + len]) {
+	len++;
+      }
+
+      if(!emit_literals(src, lit_start, ip, dst, &op, limit)
+	 || op + 3 > limit) {
+	return 0;
+      }
+
+      size_t offset = ip - cand - 1;
+      dst[op++] = 0x80 | (len - MIN_MATCH);
+      dst[op++] = offset & 0xff;
+      dst[op++] = offset >> 8;
+
+      ip += len;
+      lit_start = ip;
+    } else {
+      ip++;
+    }
+  }
+
+  if(!emit_literals(src, lit_start, PGSIZE, dst, &op, limit)) {
+    return 0;
+  }
+  return op;
+}
+
+/* Decompresses size bytes produced by compress_page() at src into the
+   page at dst */
+void decompress_page(const void *src_, size_t size, void *dst_) {
+  const uint8_t *src = src_;
+  uint8_t *dst = dst_;
+  size_t ip = 0, op = 0;
+
+  while(ip < size) {
+    uint8_t c = src[ip++];
+
+    if(c < 0x80) {
+      size_t n = c + 1;
+      ASSERT(ip + n <= size && op + n <= PGSIZE);
+      memcpy(dst + op, src + ip, n);
+      ip += n;
+      op += n;
+    } else {
+      size_t len = (c & 0x7f) + MIN_MATCH;
+      ASSERT(ip + 2 <= size);
+      size_t offset = (src[ip] | (src[ip + 1] << 8)) + 1;
+      ip += 2;
+      ASSERT(offset <= op && op + len <= PGSIZE);
+
+      /* Copy forwards a byte at a time as the match may overlap itself */
+      for(size_t i = 0; i < len; i++, op++) {
+	dst[op] = dst[op - offset];
+      }
+    }
+  }
+
+  ASSERT(op == PGSIZE);
+}
@@ -0,0 +1,9 @@
+#ifndef VM_COMPRESS
+#define VM_COMPRESS
+
+#include <stddef.h>
+
+size_t compress_page(const void *, void *, size_t);
+void decompress_page(const void *, size_t, void *);
+
+#endif
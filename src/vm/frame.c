@@ -1,33 +1,122 @@
 #include "vm/frame.h"
 #include <debug.h>
+#include <round.h>
+#include <stdint.h>
+#include <stdio.h>
 
 #include "threads/vaddr.h"
 #include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "devices/timer.h"
 #include "userprog/exception.h"
-
-/* Frame table */
-static struct hash frame_table;
+#include "userprog/pagedir.h"
+#include "userprog/syscall.h"
+#include "filesys/inode.h"
+#include "vm/swap.h"
+#include "vm/prefetch.h"
+
+/* Frame table, indexed by page number within the user pool */
+static struct frame_table_entry *frame_table;
+static uint8_t *user_base;       /* Kernel address of the first user frame */
+static size_t frame_cnt;         /* Number of frames in the user pool */
 static struct lock frame_table_lock;
 
-extern struct lock allocation_lock;
+/* Signalled with the frame table lock whenever frames stop being in
+   transit, for threads waiting to use or free one of their pages */
+static struct condition transit_done;
+static size_t transit_cnt;       /* Number of frames in transit */
+
+/* Page of zeroes mapped read only into untouched zero and stack pages on
+   read faults, taken from the kernel pool so it is never evicted */
+static void *zero_frame;
+
+/* Index of the next frame the clock hand will look at.  The hand
+   persists across evictions so that each frame is only passed over
+   once per revolution */
+static size_t clock_hand;
+
+/* Ticks of its owner's virtual time after which a frame that has not been
+   used is outside the owner's working set */
+#define WORKING_SET_WINDOW (TIMER_FREQ / 2)
+
+/* Default resident limit as a fraction of the user pool that is kept from
+   any one process */
+#define DEFAULT_RESIDENT_RESERVE (4)
+
+/* Smallest resident limit, enough for the pages one instruction can touch
+   at worst, its code, a source and a destination each spanning two pages,
+   along with the stack, so that a process at its limit cannot keep
+   evicting one of the pages it needs to load another */
+#define MIN_RESIDENT_LIMIT (8)
+
+/* Resident pages allowed to a process started by the kernel, whereas a
+   process started by another inherits its parent's limit */
+static size_t default_resident_limit;
+
+/* Eviction statistics */
+static long long eviction_cnt;
+static long long local_eviction_cnt;
+static long long hand_move_cnt;
+static long long swap_cluster_cnt;
+static long long swap_write_cnt;
+static long long swap_write_avoided_cnt;
+static long long mmap_write_cnt;
+static long long mmap_fallback_cnt;
 
 /* Shared table */
 static struct hash shared_table;
 static struct lock shared_table_lock;
 
-/* Hash functions for frame_table */
-static hash_hash_func hash_frame_address;
-static hash_less_func cmp_frame_address;
-static hash_action_func reset_reference_bit;
+/* What has to happen to a victim once it has been unmapped */
+enum victim_action {
+  VICTIM_FREE,             /* Nothing to write, the frame can be reused */
+  VICTIM_SWAP,             /* Anonymous data to write to swap */
+  VICTIM_FILE              /* Memory mapped data to write to its file */
+};
+
+/* Clock helpers */
+static struct frame_table_entry *clock_advance(void);
+static bool ft_test_and_clear_accessed(struct frame_table_entry *);
+static bool ft_range_pinned(const struct frame_table_entry *);
+static uint32_t ft_virtual_time(const struct frame_table_entry *);
+static uint32_t ft_age(const struct frame_table_entry *);
+static bool ft_is_clean(const struct frame_table_entry *);
+static bool ft_owned_by(const struct frame_table_entry *,
+			const struct thread *);
+
+/* Eviction helpers */
+static enum victim_action ft_unmap_victim(struct frame_table_entry *);
+static bool ft_write_back(struct frame_table_entry *);
+static size_t ft_reserve_swap(struct frame_table_entry **, size_t);
+static size_t ft_swap_out(struct frame_table_entry **, size_t);
+static void ft_restore_victim(struct frame_table_entry *);
+static void ft_finish_victim(struct frame_table_entry *);
 
 /* Hash functions for shared_table */
 static hash_hash_func hash_file;
 static hash_less_func cmp_file;
 
-/* Initialise frame_table and frame_table_lock */
-void ft_init(void) {
-  hash_init(&frame_table, hash_frame_address, cmp_frame_address, NULL);
+/* Initialise frame_table and frame_table_lock
+   Allocates one entry for every page of the user pool from the kernel pool,
+   so MUST BE CALLED AFTER palloc_init
+   Takes the default resident limit of a process in pages, where SIZE_MAX
+   selects a default derived from the size of the user pool */
+void ft_init(size_t resident_limit) {
+  void *base;
+  palloc_get_user_pool(&base, &frame_cnt);
+
+  if(resident_limit == SIZE_MAX) {
+    resident_limit = frame_cnt - frame_cnt / DEFAULT_RESIDENT_RESERVE;
+  }
+  user_base = base;
+  default_resident_limit = ft_clamp_resident_limit(resident_limit);
+
+  size_t table_pages = DIV_ROUND_UP(frame_cnt * sizeof *frame_table, PGSIZE);
+  frame_table = palloc_get_multiple(PAL_ASSERT | PAL_ZERO, table_pages);
+  zero_frame = palloc_get_page(PAL_ASSERT | PAL_ZERO);
+  clock_hand = 0;
   lock_init(&frame_table_lock);
+  cond_init(&transit_done);
 }
 
 /* Initialise shared table */
@@ -36,33 +125,16 @@ void st_init(void) {
   lock_init(&shared_table_lock);
 }
 
-/* Generates a hash function from the user virtual address of a page 
-   hash function is address divided by page size which acts as a page number */
-static unsigned hash_frame_address(const struct hash_elem *e,
-				   void *aux UNUSED) {
-  struct frame_table_entry *ft = hash_entry(e, struct frame_table_entry, elem);
-
-  return ((unsigned) ft->frame) / PGSIZE;
-}
-
-/* Compares two frame table elems based on user address */
-static bool cmp_frame_address(const struct hash_elem *a,
-			     const struct hash_elem *b, void *aux UNUSED) {
-  struct frame_table_entry *ft1 = hash_entry(a, struct frame_table_entry, elem);
-  struct frame_table_entry *ft2 = hash_entry(b, struct frame_table_entry, elem);
-
-  return ft1->frame < ft2->frame;
-}
-
-/* Generates a hash function from the file pointer address of a shared page */
+/* Generates a hash function from the inode number and page index of a
+   shared page */
 static unsigned hash_file(const struct hash_elem *e, void *aux UNUSED) {
   struct shared_table_entry *st =
     hash_entry(e, struct shared_table_entry, elem);
 
-  return (unsigned) st->file + st->offset;
+  return hash_bytes(&st->key, sizeof st->key);
 }
 
-/* Compares two shared table elems based on file pointer address */
+/* Compares two shared table elems on inode number, then page index */
 static bool cmp_file(const struct hash_elem *a,
 			     const struct hash_elem *b, void *aux UNUSED) {
   struct shared_table_entry *st1 =
@@ -70,13 +142,37 @@ static bool cmp_file(const struct hash_elem *a,
   struct shared_table_entry *st2 =
     hash_entry(b, struct shared_table_entry, elem);
 
-  return ((off_t) st1->file) + st1->offset < ((off_t)st2->file) + st2->offset;
+  if(st1->key.inumber != st2->key.inumber) {
+    return st1->key.inumber < st2->key.inumber;
+  }
+  return st1->key.page_no < st2->key.page_no;
+}
+
+/* Sets the key of a shared table entry from the file and offset of the
+   page it shares */
+void st_set_key(struct shared_table_entry *st, struct file *file,
+		off_t offset) {
+  st->key.inumber = inode_get_inumber(file_get_inode(file));
+  st->key.page_no = offset / PGSIZE;
 }
 
-/* Inserts hash_elem elem into the frame_table 
+/* Starts using the frame table entry of a user frame 
+   Takes the kernel virtual address of the frame and whether it is writable
+   Returns the entry, which has no owners yet
    SHOULD BE CALLED WITH THE FRAME TABLE LOCK ACQUIRED */
-void ft_insert_entry(struct hash_elem *elem) {
-  hash_insert(&frame_table, elem);
+struct frame_table_entry *ft_insert_entry(void *frame, bool writable) {
+  struct frame_table_entry *ft = ft_find_entry(frame);
+
+  ASSERT(ft != NULL && ft->owners == NULL);
+
+  ft->st = NULL;
+  ft->last_use = thread_current()->virtual_ticks;
+  ft->reference_bit = false;
+  ft->writable = writable;
+  ft->pinned = false;
+  ft->in_transit = false;
+
+  return ft;
 }
 
 /* Inserts hash_elem elem into the shared_table 
@@ -85,34 +181,64 @@ void st_insert_entry(struct hash_elem *elem) {
   hash_insert(&shared_table, elem);
 }
 
-/* Gets a frame table entry from its hash table with a matching user address
-   Takes in a user virtual address to search for 
-   Returns pointer to the table entry or NULL if unsuccessful 
-   SHOULD BE CALLED WITH THE FRAME TABLE LOCK ACQUIRED */
+/* Gets the frame table entry of a user frame
+   Takes in any kernel virtual address inside the frame
+   Returns pointer to the table entry or NULL if it is not a user frame */
 struct frame_table_entry *ft_find_entry(const void *frame) {
-  struct frame_table_entry key;
-  
-  key.frame = pg_round_down(frame);
+  const uint8_t *kpage = pg_round_down(frame);
 
-  struct hash_elem *elem = hash_find(&frame_table, &key.elem);
-
-  if(elem == NULL) {
+  if(kpage < user_base || kpage >= user_base + frame_cnt * PGSIZE) {
     return NULL;
   }
 
-  return hash_entry(elem, struct frame_table_entry, elem);
+  return &frame_table[(kpage - user_base) / PGSIZE];
 }
 
-/* Gets a shared table entry from its hash table with a matching file address
-   Takes in a file address to search for 
+/* Returns the kernel virtual address of the frame an entry describes */
+void *ft_get_frame(const struct frame_table_entry *ft) {
+  return user_base + (ft - frame_table) * PGSIZE;
+}
+
+/* Returns the kernel virtual address of the shared zero frame
+   It must only ever be mapped read only */
+void *ft_get_zero_frame(void) {
+  return zero_frame;
+}
+
+/* Adds a supplemental page table entry to the owners of a frame
+   SHOULD BE CALLED WITH THE FRAME TABLE LOCK ACQUIRED */
+void ft_add_owner(struct frame_table_entry *ft, struct sup_table_entry *spt) {
+  spt->next_owner = ft->owners;
+  ft->owners = spt;
+  spt->owner->resident_cnt++;
+}
+
+/* Removes a supplemental page table entry from the owners of a frame
+   Does nothing if it is not an owner
+   SHOULD BE CALLED WITH THE FRAME TABLE LOCK ACQUIRED */
+void ft_remove_owner(struct frame_table_entry *ft,
+		     struct sup_table_entry *spt) {
+  struct sup_table_entry **cur;
+
+  for(cur = &ft->owners; *cur != NULL; cur = &(*cur)->next_owner) {
+    if(*cur == spt) {
+      *cur = spt->next_owner;
+      spt->next_owner = NULL;
+      spt->owner->resident_cnt--;
+      return;
+    }
+  }
+}
+
+/* Gets a shared table entry from its hash table with a matching file page
+   Takes in the file and offset of the page to search for, where any
+   struct file open on the same inode will match
    Returns pointer to the table entry or NULL if unsuccessful 
    SHOULD BE CALLED WITH THE SHARED TABLE LOCK ACQUIRED */
-struct shared_table_entry *st_find_entry(const struct file *file,
-					 off_t offset) {
+struct shared_table_entry *st_find_entry(struct file *file, off_t offset) {
   struct shared_table_entry key;
   
-  key.file = file;
-  key.offset = offset;
+  st_set_key(&key, file, offset);
 
   struct hash_elem *elem = hash_find(&shared_table, &key.elem);
 
@@ -123,100 +249,500 @@ struct shared_table_entry *st_find_entry(const struct file *file,
   return hash_entry(elem, struct shared_table_entry, elem);
 }
 
-/* Finds a frame to evict and returns it 
+/* Returns the frame under the clock hand and moves the hand on by one,
+   wrapping around to the start of the table when it reaches the end
    MUST BE CALLED WITH THE FRAME TABLE LOCK */
-struct frame_table_entry *ft_get_victim(void) {
-  struct hash_iterator iterator;
-  struct hash_elem *cur;
-  struct frame_table_entry *ft;
-  
-  hash_first(&iterator, &frame_table);
+static struct frame_table_entry *clock_advance(void) {
+  struct frame_table_entry *ft = &frame_table[clock_hand];
 
-  bool victim_found = false;
-  
-  while (!victim_found && hash_next(&iterator)) {
-    cur = hash_cur(&iterator);
-    ft = hash_entry(cur, struct frame_table_entry, elem);
-    victim_found = !ft->reference_bit && !ft->pinned;
+  clock_hand = (clock_hand + 1) % frame_cnt;
+  hand_move_cnt++;
+
+  return ft;
+}
+
+/* Returns whether a frame has been referenced since the hand last passed
+   it, from either its reference bit or the accessed bits of its owners'
+   page directories, and clears them all */
+static bool ft_test_and_clear_accessed(struct frame_table_entry *ft) {
+  bool accessed = ft->reference_bit;
+  ft->reference_bit = false;
+
+  struct sup_table_entry *spt;
+  for(spt = ft->owners; spt != NULL; spt = spt->next_owner) {
+    uint32_t *pd = spt->owner->pagedir;
+
+    if(pd != NULL && pagedir_is_accessed(pd, spt->upage)) {
+      pagedir_set_accessed(pd, spt->upage, false);
+      prefetch_account(spt, true);
+      accessed = true;
+    }
   }
 
-  /* Now check again for any unpinned page */
-  if (!victim_found) {
-    hash_first(&iterator, &frame_table);
+  return accessed;
+}
+
+/* Returns the virtual time of a frame's first owner, in which the frame's
+   last use is measured
+   MUST BE CALLED WITH THE FRAME TABLE LOCK */
+static uint32_t ft_virtual_time(const struct frame_table_entry *ft) {
+  return ft->owners->owner->virtual_ticks;
+}
+
+/* Returns how long ago, in its first owner's virtual time, a frame was
+   last seen to be used
+   The difference is taken modulo 2^32, so a frame deactivated early in
+   its owner's life is still old. A frame whose first owner has changed
+   since may appear to have been used in the future, and is treated as
+   just used
+   MUST BE CALLED WITH THE FRAME TABLE LOCK */
+static uint32_t ft_age(const struct frame_table_entry *ft) {
+  int32_t age = (int32_t) (ft_virtual_time(ft) - ft->last_use);
+
+  return age > 0 ? (uint32_t) age : 0;
+}
+
+/* Returns whether a frame can be evicted without writing it anywhere
+   MUST BE CALLED WITH THE FRAME TABLE LOCK */
+static bool ft_is_clean(const struct frame_table_entry *ft) {
+  if(!ft->writable) {
+    return true;
+  }
 
-    while (!victim_found && hash_next(&iterator)) {
-      cur = hash_cur(&iterator);
-      ft = hash_entry(cur, struct frame_table_entry, elem);
-      victim_found = !ft->pinned;
+  struct sup_table_entry *spt = ft->owners;
+  uint32_t *pd = spt->owner->pagedir;
+  bool dirty = pd != NULL && pagedir_is_dirty(pd, spt->upage);
+
+  return !dirty && (spt->in_swap || !spt->modified);
+}
+
+/* Returns whether a frame belongs to a process alone, so that evicting it
+   only takes memory from that process
+   MUST BE CALLED WITH THE FRAME TABLE LOCK */
+static bool ft_owned_by(const struct frame_table_entry *ft,
+			const struct thread *t) {
+  return ft->owners->owner == t && ft->owners->next_owner == NULL;
+}
+
+/* Finds a frame to evict using the WSClock algorithm and returns it 
+   The hand harvests the accessed bits of every frame it passes, stamping
+   the frames that were used with their owner's virtual time. The first
+   clean frame that has not been used for WORKING_SET_WINDOW ticks of its
+   owner's virtual time, and so is outside its working set, is the victim.
+   Failing that, the first such dirty frame seen in a revolution is taken,
+   and failing that the least recently used frame seen once every
+   accessed bit has been cleared, which takes at most two revolutions
+   Pinned frames and frames in transit are passed over
+   Takes the process to replace one of the pages of, for a process over
+   its resident limit, in which case the hand leaves other processes'
+   frames untouched, or NULL to choose among every process's frames
+   Returns NULL if no frame can be evicted
+   MUST BE CALLED WITH THE FRAME TABLE LOCK */
+struct frame_table_entry *ft_get_victim(struct thread *owner) {
+  struct frame_table_entry *dirty = NULL;
+  struct frame_table_entry *oldest = NULL;
+  uint32_t oldest_age = 0;
+
+  for(size_t i = 0; i < 2 * frame_cnt; i++) {
+    struct frame_table_entry *ft = clock_advance();
+
+    if(ft->owners == NULL || ft->pinned || ft->in_transit
+       || ft_range_pinned(ft) || (owner != NULL && !ft_owned_by(ft, owner))) {
+      continue;
     }
 
-    /* All frames are pinned, swap cannot happen */
-    if (!victim_found) {
-      ft_lock_release();
-      thread_exit();
+    if(ft_test_and_clear_accessed(ft)) {
+      ft->last_use = ft_virtual_time(ft);
+      continue;
+    }
+
+    uint32_t age = ft_age(ft);
+    if(age > WORKING_SET_WINDOW) {
+      if(ft_is_clean(ft)) {
+	eviction_cnt++;
+	return ft;
+      }
+      if(dirty == NULL) {
+	dirty = ft;
+      }
+    }
+
+    if(oldest == NULL || age > oldest_age) {
+      oldest = ft;
+      oldest_age = age;
+    }
+
+    /* Settle for a dirty or recently used frame after a revolution */
+    if(i + 1 >= frame_cnt && (dirty != NULL || oldest != NULL)) {
+      break;
+    }
+  }
+
+  struct frame_table_entry *victim = dirty != NULL ? dirty : oldest;
+  if(victim != NULL) {
+    eviction_cnt++;
+  }
+  return victim;
+}
+
+/* Makes a frame the next to be evicted, by clearing its reference bit and
+   placing its last use outside the working set
+   MUST BE CALLED WITH THE FRAME TABLE LOCK */
+void ft_deactivate(struct frame_table_entry *ft) {
+  ft->reference_bit = false;
+  ft->last_use = ft_virtual_time(ft) - WORKING_SET_WINDOW - 1;
+}
+
+/* Returns the resident limit of a process started by the kernel */
+size_t ft_default_resident_limit(void) {
+  return default_resident_limit;
+}
+
+/* Returns the nearest usable resident limit to a requested one, at least
+   MIN_RESIDENT_LIMIT and at most the size of the user pool */
+size_t ft_clamp_resident_limit(size_t limit) {
+  if(limit < MIN_RESIDENT_LIMIT) {
+    return MIN_RESIDENT_LIMIT;
+  }
+  return limit < frame_cnt ? limit : frame_cnt;
+}
+
+/* Unmaps a victim from every owner and releases it if nothing has to be
+   written first
+   Returns what has to be written before the frame can be reused, in which
+   case it is marked as in transit, so that the hand skips it and its owner
+   waits for it, until the write completes
+   MUST BE CALLED WITH THE FRAME TABLE LOCK */
+static enum victim_action ft_unmap_victim(struct frame_table_entry *ft) {
+  struct sup_table_entry *spt;
+
+  if(ft->writable) {
+    /* Get the frame's owner (only has one owner as writable) */
+    spt = ft->owners;
+    uint32_t *pd = spt->owner->pagedir;
+
+    /* A page read ahead that is evicted before being touched was wasted */
+    prefetch_account(spt, false);
+
+    /* Unmap the page first so that no writes are lost after the
+       dirty bit has been read */
+    bool dirty = false;
+    if(pd != NULL) {
+      pagedir_clear_page(pd, spt->upage);
+      dirty = pagedir_is_dirty(pd, spt->upage);
     }
-    return hash_entry(cur, struct frame_table_entry, elem);
+
+    if(spt->in_swap && !dirty) {
+      /* The swap slot still holds the page, so nothing is written */
+      if(spt->type == ZERO_PAGE || spt->type == FILE_PAGE) {
+        spt->type = IN_SWAP_FILE;
+      }
+      swap_write_avoided_cnt++;
+    } else if(dirty || spt->modified) {
+      if(spt->in_swap) {
+        /* The copy in swap is out of date */
+        swap_lock_acquire();
+        remove_swap_space(spt->block_number, 1);
+        swap_lock_release();
+        spt->in_swap = false;
+      }
+
+      ft->in_transit = true;
+      transit_cnt++;
+      return spt->type == MMAPPED_PAGE ? VICTIM_FILE : VICTIM_SWAP;
+    } else if(spt->type == STACK_PAGE) {
+      /* A stack page that was never written is still all zeroes */
+      spt->type = NEW_STACK_PAGE;
+    }
+    spt->owner->resident_cnt--;
+    spt->ft = NULL;
   } else {
-    return ft;
+    /* Remove each owner of the frame and remove the shared table entry */
+    if(ft->st != NULL) {
+      st_lock_acquire();
+      st_remove_entry(ft->st);
+      st_lock_release();
+    }
+
+    for(spt = ft->owners; spt != NULL; spt = spt->next_owner) {
+      prefetch_account(spt, false);
+      if(spt->owner->pagedir != NULL) {
+        pagedir_clear_page(spt->owner->pagedir, spt->upage);
+      }
+      spt->owner->resident_cnt--;
+      spt->ft = NULL;
+    }
+  }
+  ft->owners = NULL;
+  ft->pinned = false;
+
+  return VICTIM_FREE;
+}
+
+/* Writes a dirty memory mapped victim back to its file, after which its
+   page can be read from the file again
+   Waiting for the file's inode lock is safe, as its holder never faults:
+   system call buffers are pinned before any inode lock is taken
+   Returns false if the write fell short, for example because the disk is
+   full, in which case the victim has to be written to swap instead
+   SHOULD BE CALLED WITHOUT THE FRAME TABLE LOCK, WITH THE VICTIM IN TRANSIT */
+static bool ft_write_back(struct frame_table_entry *ft) {
+  struct sup_table_entry *spt = ft->owners;
+
+  return file_write_at(spt->file, ft_get_frame(ft), spt->read_bytes,
+		       spt->offset) == spt->read_bytes;
+}
+
+/* Reserves swap slots for dirty victims in as few contiguous runs as swap
+   fragmentation allows, recording each victim's slot in its page
+   Takes the victims and how many there are
+   Returns the number of victims given a slot, which are the first ones
+   SHOULD BE CALLED WITHOUT THE FRAME TABLE LOCK, WITH THE VICTIMS IN TRANSIT */
+static size_t ft_reserve_swap(struct frame_table_entry **victims, size_t cnt) {
+  size_t done = 0;
+
+  swap_lock_acquire();
+  while(done < cnt) {
+    size_t run = cnt - done;
+    size_t start = find_swap_space(run);
+
+    while(start == BITMAP_ERROR && run > 1) {
+      run /= 2;
+      start = find_swap_space(run);
+    }
+
+    if(start == BITMAP_ERROR) {
+      break;
+    }
+
+    for(size_t i = 0; i < run; i++) {
+      victims[done + i]->owners->block_number = start + i * SECTORS_PER_PAGE;
+    }
+    done += run;
+  }
+  swap_lock_release();
+
+  return done;
+}
+
+/* Writes dirty victims to the swap slots reserved for them, each run of
+   consecutive slots as a single transfer
+   Takes the victims and how many there are
+   Returns the number of transfers
+   SHOULD BE CALLED WITHOUT THE FRAME TABLE LOCK, WITH THE VICTIMS IN TRANSIT */
+static size_t ft_swap_out(struct frame_table_entry **victims, size_t cnt) {
+  void *frames[EVICT_BATCH];
+  size_t first = 0;
+  size_t runs = 0;
+
+  while(first < cnt) {
+    size_t start = victims[first]->owners->block_number;
+    size_t run = 0;
+
+    do {
+      frames[run] = ft_get_frame(victims[first + run]);
+      run++;
+    } while(first + run < cnt
+	    && victims[first + run]->owners->block_number
+	       == start + run * SECTORS_PER_PAGE);
+
+    swap_write_frames(frames, run, start);
+    first += run;
+    runs++;
+  }
+
+  return runs;
+}
+
+/* Maps a dirty victim that could not be written to swap back into its
+   owner, keeping it dirty so that no data is lost
+   MUST BE CALLED WITH THE FRAME TABLE LOCK */
+static void ft_restore_victim(struct frame_table_entry *ft) {
+  struct sup_table_entry *spt = ft->owners;
+  uint32_t *pd = spt->owner->pagedir;
+
+  if(pd != NULL) {
+    pagedir_set_page(pd, spt->upage, ft_get_frame(ft), true);
+    pagedir_set_dirty(pd, spt->upage, true);
+  }
+  ft->in_transit = false;
+  transit_cnt--;
+}
+
+/* Releases a victim whose data has been written, leaving its frame with
+   no owners
+   MUST BE CALLED WITH THE FRAME TABLE LOCK */
+static void ft_finish_victim(struct frame_table_entry *ft) {
+  ft->owners->owner->resident_cnt--;
+  ft->owners->ft = NULL;
+  ft->owners = NULL;
+  ft->in_transit = false;
+  transit_cnt--;
+}
+
+/* Evicts up to cnt frames chosen by the clock algorithm 
+   Only choosing the victims is done with the frame table lock held. Clean
+   victims are simply unmapped from every owner. Dirty ones are marked as
+   in transit and written with no lock held, so that several threads can
+   evict and write at once: memory mapped victims back to their files,
+   the rest to swap, together as sequential runs
+   Takes an array to fill with the kernel virtual addresses of the evicted
+   frames, which stay allocated from the user pool but have no owners,
+   the most frames to evict, at most EVICT_BATCH, and the process to evict
+   only the frames of, or NULL for any process
+   Returns the number of frames evicted, 0 if none could be
+   MUST BE CALLED WITHOUT THE FRAME TABLE LOCK */
+size_t ft_evict_frames(void **kpages, size_t cnt, struct thread *owner) {
+  struct frame_table_entry *mapped[EVICT_BATCH];
+  struct frame_table_entry *dirty[EVICT_BATCH];
+  size_t mapped_cnt = 0;
+  size_t dirty_cnt = 0;
+  size_t evicted = 0;
+
+  ASSERT(cnt <= EVICT_BATCH);
+
+  /* Choose the victims */
+  ft_lock_acquire();
+  while(evicted + mapped_cnt + dirty_cnt < cnt) {
+    struct frame_table_entry *ft = ft_get_victim(owner);
+
+    if(ft == NULL) {
+      /* Rather than give up while other threads are evicting, wait for
+	 their victims to be released and look again */
+      if(owner == NULL && evicted + mapped_cnt + dirty_cnt == 0
+	 && transit_cnt > 0) {
+	cond_wait(&transit_done, &frame_table_lock);
+	continue;
+      }
+
+      /* All frames are pinned or already chosen */
+      break;
+    }
+
+    switch(ft_unmap_victim(ft)) {
+      case VICTIM_FILE:
+        mapped[mapped_cnt++] = ft;
+        break;
+      case VICTIM_SWAP:
+        dirty[dirty_cnt++] = ft;
+        break;
+      case VICTIM_FREE:
+        kpages[evicted++] = ft_get_frame(ft);
+        break;
+    }
+  }
+  if(owner != NULL) {
+    local_eviction_cnt += evicted + mapped_cnt + dirty_cnt;
+  }
+  ft_lock_release();
+
+  /* Write the victims in transit */
+  size_t written_back = 0;
+  for(size_t i = 0; i < mapped_cnt; i++) {
+    if(ft_write_back(mapped[i])) {
+      mapped[written_back++] = mapped[i];
+    } else {
+      dirty[dirty_cnt++] = mapped[i];
+    }
+  }
+
+  size_t reserved = ft_reserve_swap(dirty, dirty_cnt);
+  size_t runs = ft_swap_out(dirty, reserved);
+
+  /* Release them and wake any thread waiting for one of their pages */
+  ft_lock_acquire();
+  for(size_t i = 0; i < written_back; i++) {
+    mapped[i]->owners->modified = false;
+    ft_finish_victim(mapped[i]);
+    kpages[evicted++] = ft_get_frame(mapped[i]);
   }
+  mmap_write_cnt += written_back;
+  mmap_fallback_cnt += mapped_cnt - written_back;
+
+  for(size_t i = 0; i < dirty_cnt; i++) {
+    struct sup_table_entry *spt = dirty[i]->owners;
+
+    if(i >= reserved) {
+      /* Swap is full */
+      ft_restore_victim(dirty[i]);
+      continue;
+    }
+
+    /* Indicate file is in swap system if it is a file page */
+    if(spt->type == ZERO_PAGE || spt->type == FILE_PAGE) {
+      spt->type = IN_SWAP_FILE;
+    }
+    spt->modified = true;
+    spt->in_swap = true;
+    ft_finish_victim(dirty[i]);
+    kpages[evicted++] = ft_get_frame(dirty[i]);
+  }
+  swap_write_cnt += reserved;
+  swap_cluster_cnt += runs;
+
+  if(mapped_cnt + dirty_cnt > 0) {
+    cond_broadcast(&transit_done, &frame_table_lock);
+  }
+  ft_lock_release();
+
+  return evicted;
 }
 
-/* Hash action func that resets a reference bit to 0 */
-static void reset_reference_bit(struct hash_elem *e, void *aux UNUSED) {
-  struct frame_table_entry *ft = hash_entry(e, struct frame_table_entry, elem);
+/* Waits until a page is no longer in transit, after which it is either
+   still in its frame or out of memory
+   Takes the page's supplemental page table entry */
+void ft_wait_transit(struct sup_table_entry *spt) {
+  bool lock_held = ft_lock_held_by_current_thread();
 
-  ft->reference_bit = 0;
+  run_if_false(ft_lock_acquire(), lock_held);
+  while(spt->ft != NULL && spt->ft->in_transit) {
+    cond_wait(&transit_done, &frame_table_lock);
+  }
+  run_if_false(ft_lock_release(), lock_held);
 }
 
-/* Resets all reference bits in the frame table to 0 */
-void ft_reset_reference_bits(void) {
-  hash_apply(&frame_table, reset_reference_bit);
+/* Prints eviction statistics */
+void ft_print_stats(void) {
+  printf("Frames: %lld evictions (%lld within a resident limit), "
+	 "%lld clock hand moves\n",
+	 eviction_cnt, local_eviction_cnt, hand_move_cnt);
+  printf("Swap: %lld pages written in %lld clusters, "
+	 "%lld clean rewrites avoided\n",
+	 swap_write_cnt, swap_cluster_cnt, swap_write_avoided_cnt);
+  printf("Mmap: %lld pages written back, %lld sent to swap\n",
+	 mmap_write_cnt, mmap_fallback_cnt);
 }
 
-/* Removes a frame table entry from the table and frees it 
-   Takes in the user virtual address of the entry to remove 
-   Does nothing if the entry doesn't exist 
-   SHOULD BE CALLED WITH THE FRAME TABLE
-   AND OWNERS LIST LOCKS ACQUIRED */
+/* Stops using a frame table entry and frees its frame and shared table
+   entry
+   Takes in the kernel virtual address of the entry to remove 
+   Does nothing if the address is not a user frame
+   SHOULD BE CALLED WITH THE FRAME TABLE LOCK ACQUIRED
+   AND AFTER THE LAST OWNER HAS BEEN REMOVED */
 void ft_remove_entry(void *frame) {
   struct frame_table_entry *ft = ft_find_entry(frame);
   
-  //ASSERT(lock_held_by_current_thread(&ft->owners_lock));
-  
   if(ft != NULL) {
-    struct hash_iterator iterator;
-    struct shared_table_entry *st;
-    
-    hash_first(&iterator, &shared_table);
-    bool found = false;
-    
-    st_lock_acquire();
-    while (!found && hash_next(&iterator)) {
-      st = hash_entry(hash_cur(&iterator), struct shared_table_entry, elem);
-      if (ft == st->ft) {
-	hash_delete(&shared_table, &st->elem);
-	free(st);
-	found = true;
-      }
+    ASSERT(ft->owners == NULL);
+
+    if(ft->st != NULL) {
+      st_lock_acquire();
+      st_remove_entry(ft->st);
+      st_lock_release();
     }
-    st_lock_release(); 
-    hash_delete(&frame_table, &ft->elem);
-    //lock_release(&ft->owners_lock);
-    free(ft);
+
+    ft->pinned = false;
+    palloc_free_page(ft_get_frame(ft));
   }
 }
 
 /* Removes a shared table entry from the table and frees it 
-   Takes in the file address of the entry to remove 
-   Does nothing if the entry doesn't exist 
+   Takes in the entry to remove, which is unlinked from its frame
    SHOULD BE CALLED WITH THE SHARED TABLE LOCK ACQUIRED */
-void st_remove_entry(struct file *file, off_t offset) {
-  struct shared_table_entry *st = st_find_entry(file, offset);
-
-  if(st != NULL) {
-    hash_delete(&shared_table, &st->elem);
-    free(st);
-  }
+void st_remove_entry(struct shared_table_entry *st) {
+  hash_delete(&shared_table, &st->elem);
+  st->ft->st = NULL;
+  free(st);
 }
 
 /* Functions for accessing frame_table_lock */
@@ -245,62 +771,74 @@ bool st_lock_held_by_current_thread(void) {
   return lock_held_by_current_thread(&shared_table_lock);
 }
 
-/* Pins a buffer at uaddr of size size so its frames cannot be evicted 
-   Takes the start address of the buffer and its size */
-void ft_pin(const void *uaddr, unsigned size) {
-  ASSERT (is_user_vaddr(uaddr));
-    
+/* Pins the pages of a user buffer so that a system call can access them
+   without faulting, for example while holding an inode lock
+   The range is recorded in the thread before any page is loaded, so pages
+   already in memory are pinned straight away and missing ones as soon as
+   they are loaded, pages read from files being read ahead together
+   Every page of the range stays resident until it is unpinned, so callers
+   keep it to a few pages
+   Takes the start of the buffer, its size, the user stack pointer for
+   stack growth and whether the buffer will be written
+   Returns a handle to pass to ft_unpin_range()
+   Kills the thread if a page is not valid user memory, or is read only
+   and the buffer will be written */
+struct pin_range *ft_pin_range(const void *uaddr, unsigned size, void *esp,
+			       bool write) {
   struct thread *t = thread_current();
-  struct sup_table_entry *spt;
-  while(size > 0) {
-    
-    spt = spt_find_entry(t, uaddr);
-    spt = grow_stack(uaddr, spt);
-    
-    if(spt == NULL) {
+  struct pin_range *pin = &t->pinned;
+  void *start = pg_round_down(uaddr);
+  void *end = pg_round_up(uaddr + size);
+
+  ASSERT(pin->start == pin->end);
+  ASSERT(is_user_vaddr(uaddr));
+
+  ft_lock_acquire();
+  pin->start = start;
+  pin->end = end;
+  ft_lock_release();
+
+  for(void *upage = start; upage < end; upage += PGSIZE) {
+    struct sup_table_entry *spt = spt_find_entry(t, upage);
+
+    if(spt != NULL && write && !spt->writable) {
       thread_exit();
     }
 
-    if(spt->ft) {
-      spt->ft->pinned = true;
-    }
+    /* A page in transit is unmapped until its eviction has finished */
+    ft_lock_acquire();
+    bool mapped = spt != NULL
+      && ((spt->ft != NULL && !spt->ft->in_transit)
+	  || (spt->zero_mapped && !write));
+    ft_lock_release();
 
-    spt->pinned = true;
-    uaddr += PGSIZE;
-    if(size < PGSIZE){
-      size = 0;
-    } else {
-      size -= PGSIZE;
+    if(!mapped && !load_frame(upage, esp, LOAD_ACCESS, USER_ACCESS, write)) {
+      thread_exit();
     }
   }
+
+  return pin;
 }
 
-/* Unpins a buffer at uaddr of size size so its frames can be evicted 
-   Takes the start address of the buffer and its size */
-void ft_unpin(const void *uaddr, unsigned size) {
-  ASSERT (is_user_vaddr(uaddr));
+/* Unpins the pages pinned by ft_pin_range(), whatever their number
+   Takes the handle it returned */
+void ft_unpin_range(struct pin_range *pin) {
+  ft_lock_acquire();
+  pin->start = pin->end = NULL;
+  ft_lock_release();
+}
 
-  struct thread *t = thread_current();
+/* Returns whether a frame is in the pinned range of any of its owners
+   MUST BE CALLED WITH THE FRAME TABLE LOCK */
+static bool ft_range_pinned(const struct frame_table_entry *ft) {
   struct sup_table_entry *spt;
-  while(size > 0) {
-    
-    spt = spt_find_entry(t, uaddr);
-    spt = grow_stack(uaddr, spt);
 
-    if(spt == NULL) {
-      thread_exit();
-    }
+  for(spt = ft->owners; spt != NULL; spt = spt->next_owner) {
+    const struct pin_range *pin = &spt->owner->pinned;
 
-    if(spt->ft) {
-      spt->ft->pinned = false;
-    }
-    
-    spt->pinned = false;
-    uaddr += PGSIZE;
-    if(size < PGSIZE){
-      size = 0;
-    } else {
-      size -= PGSIZE;
+    if(spt->upage >= pin->start && spt->upage < pin->end) {
+      return true;
     }
   }
+  return false;
 }
@@ -4,52 +4,76 @@
 #include <hash.h>
 #include "threads/synch.h"
 #include "filesys/file.h"
+#include "devices/block.h"
 #include "vm/page.h"
+#include "vm/swap.h"
 
-struct lock allocation_lock;
+/* Most frames evicted, and written to swap, in one go */
+#define EVICT_BATCH SWAP_CLUSTER
+
+/* Identifies a shared page by the file it comes from rather than by the
+   struct file used to open it, so that every process running the same
+   executable finds the same page */
+struct shared_key {
+  block_sector_t inumber;       /* Inode number of the read only file */
+  size_t page_no;               /* Page index of the segment in the file */
+};
 
 /* Single row of the shared table */
 struct shared_table_entry {
   struct frame_table_entry *ft; /* Frame which the file is mapped to */
-  const struct file *file;      /* Read only file that is shared */
-  off_t offset;                 /* Offset of the file segment that is shared */
+  struct shared_key key;        /* File page that is shared */
   struct hash_elem elem;        /* Used to insert into the table */
 };
 
-/* Single row of the frame table */
+/* Single row of the frame table, one for every page of the user pool
+   Kept small as the whole table is allocated up front */
 struct frame_table_entry {
-  void *frame;             /* Frame of memory that the data corresponds to */
-  struct list owners;      /* The sup table entries that the page belongs to */
-  struct lock owners_lock; /* Restricts access to owners list */
-  int64_t timestamp;       /* Time the frame was allocated in ticks */
-  struct hash_elem elem;   /* Used to insert into the table */
+  struct sup_table_entry *owners; /* The sup table entries that the page
+				     belongs to, chained through next_owner
+				     NULL if the frame is not in use */
+  struct shared_table_entry *st;  /* Shared table entry of the frame,
+				     NULL if the frame is not shared */
+  uint32_t last_use;       /* Virtual time of the first owner when the
+			      frame was last seen to be used */
   bool reference_bit;      /* Used for second chance algorithm calculations */
-  bool modified;           /* States whether the frame has been modified */
   bool writable;           /* Whether the thread can be written to or not */
   bool pinned;		   /* True if frame is not able to be evicted */
+  bool in_transit;         /* True while the frame is being written out by
+			      an evicting thread, its owners still set */
 };
 
 /* Initialise frame_table */
-void ft_init(void);
+void ft_init(size_t);
 
 /* Manipulation of frame_table */
-void ft_insert_entry(struct hash_elem *);
+struct frame_table_entry *ft_insert_entry(void *, bool);
 struct frame_table_entry *ft_find_entry(const void *);
+void *ft_get_frame(const struct frame_table_entry *);
+void *ft_get_zero_frame(void);
 void ft_remove_entry(void *);
-void ft_pin(const void *, unsigned);
-void ft_unpin(const void *, unsigned);
-void ft_reset_reference_bits(void);
+void ft_add_owner(struct frame_table_entry *, struct sup_table_entry *);
+void ft_remove_owner(struct frame_table_entry *, struct sup_table_entry *);
+struct pin_range *ft_pin_range(const void *, unsigned, void *, bool);
+void ft_unpin_range(struct pin_range *);
+void ft_deactivate(struct frame_table_entry *);
+size_t ft_default_resident_limit(void);
+size_t ft_clamp_resident_limit(size_t);
 
 /* Page replacement algorithm */
-struct frame_table_entry *ft_get_victim(void);
+struct frame_table_entry *ft_get_victim(struct thread *);
+size_t ft_evict_frames(void **, size_t, struct thread *);
+void ft_wait_transit(struct sup_table_entry *);
+void ft_print_stats(void);
 
 /* Initialise shared_table */
 void st_init(void);
 
 /* Manipulation of shared table */
+void st_set_key(struct shared_table_entry *, struct file *, off_t);
 void st_insert_entry(struct hash_elem *);
-struct shared_table_entry *st_find_entry(const struct file *, off_t);
-void st_remove_entry(struct file *, off_t);
+struct shared_table_entry *st_find_entry(struct file *, off_t);
+void st_remove_entry(struct shared_table_entry *);
 
 /* Access functions for locks */
 void ft_lock_acquire(void);
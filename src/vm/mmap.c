@@ -1,26 +1,70 @@
 #include "vm/mmap.h"
 
 #include <debug.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
 
 #include "threads/thread.h"
 #include "threads/malloc.h"
 #include "threads/vaddr.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "devices/timer.h"
 #include "filesys/off_t.h"
 #include "userprog/syscall.h"
 #include "userprog/process.h"
 #include "userprog/pagedir.h"
 #include "vm/page.h"
+#include "vm/swap.h"
+#include "vm/frame.h"
+
+/* Most dirty pages gathered into a single write to a mapped file */
+#define SYNC_BATCH (8)
+
+/* Ticks the background flusher sleeps between writing back mappings */
+#define FLUSH_INTERVAL (2 * TIMER_FREQ)
+
+/* All complete mappings of all processes, for the background flusher
+   The lock is only held to pick a mapping, which is then written with the
+   lock released, so that mapping, unmapping and exiting do not wait on
+   the flusher's writes, except to a mapping being unmapped */
+static struct list mapping_list;
+static struct lock mapping_lock;
+static struct condition flush_done; /* A mapping stopped being flushed */
+
+/* Serialises syncs and protects sync_buffer, into which runs of adjacent
+   dirty pages are copied to be written with a single file write */
+static struct lock sync_lock;
+static void *sync_buffer;
+
+/* Sync statistics */
+static long long sync_write_cnt;
+static long long sync_page_cnt;
 
 /* Hash functions for mmap_table */
 static hash_hash_func mmap_hash_mapid;
 static hash_less_func mmap_cmp_mapid;
 static hash_action_func mmap_destroy_entry;
+static void mmap_sync_pages(struct mmap_entry *, size_t, size_t);
+static thread_func mmap_flusher NO_RETURN;
 
 /* Initialise sup_table */
 void mmap_init(struct hash *mmap_table) {
   hash_init(mmap_table, mmap_hash_mapid, mmap_cmp_mapid, NULL);
 }
 
+/* Initialises the list of all mappings and the sync buffer and starts the
+   background flusher thread */
+void mmap_sync_init(void) {
+  list_init(&mapping_list);
+  lock_init(&mapping_lock);
+  cond_init(&flush_done);
+  lock_init(&sync_lock);
+  sync_buffer = palloc_get_multiple(PAL_ASSERT, SYNC_BATCH);
+  thread_create("mmap-flush", PRI_DEFAULT, mmap_flusher, NULL);
+}
+
 void mmap_destroy(struct hash *mmap_table) {
   hash_destroy(mmap_table, mmap_destroy_entry);
 }
@@ -55,6 +99,10 @@ mapid_t mmap_create_entry(struct file *file, void *addr) {
   mmap_entry->map_id = t->next_map_id;
   mmap_entry->file = file;
   mmap_entry->addr = addr;
+  mmap_entry->owner = t;
+  mmap_entry->page_cnt = 0;
+  mmap_entry->pages = NULL;
+  mmap_entry->flushing = false;
   hash_insert(&t->mmap_table, &mmap_entry->elem);
   remove_alloc_elem(mmap_entry);
 
@@ -79,6 +127,234 @@ struct mmap_entry *mmap_find_entry(mapid_t map_id) {
   return hash_entry(elem, struct mmap_entry, elem);
 }
 
+/* Records the supplemental page table entries of a complete mapping and
+   makes it visible to the background flusher
+   Takes the map_id of a mapping whose pages have all been created
+   Returns false if memory could not be allocated */
+bool mmap_track_pages(mapid_t map_id) {
+  struct mmap_entry *mmap = mmap_find_entry(map_id);
+  struct thread *t = thread_current();
+
+  if(mmap == NULL) {
+    return false;
+  }
+
+  /* The file may have grown since it was mapped, so only the pages
+     counted as they were created belong to the mapping */
+  struct sup_table_entry **pages = malloc(mmap->page_cnt * sizeof *pages);
+  if(pages == NULL) {
+    return false;
+  }
+
+  for(size_t i = 0; i < mmap->page_cnt; i++) {
+    pages[i] = spt_find_entry(t, mmap->addr + i * PGSIZE);
+    ASSERT(pages[i] != NULL);
+  }
+
+  mmap->pages = pages;
+
+  lock_acquire(&mapping_lock);
+  list_push_back(&mapping_list, &mmap->list_elem);
+  lock_release(&mapping_lock);
+
+  return true;
+}
+
+/* Writes the loaded dirty pages of a mapping in [first, last) back to its
+   file
+   Runs of adjacent dirty pages are copied into the sync buffer with their
+   dirty bits cleared under the frame table lock, so they cannot be evicted
+   half copied and later writes dirty them again, then written with a
+   single file write. They stay pinned until the write is done, and any
+   page the write did not reach, for example because the disk is full, is
+   marked modified again. Pages not loaded, being loaded or being evicted
+   are left to eviction or unmapping
+   Takes the mapping and the range of page indices to write */
+static void mmap_sync_pages(struct mmap_entry *mmap, size_t first,
+			    size_t last) {
+  uint32_t *pd = mmap->owner->pagedir;
+  size_t i = first;
+
+  lock_acquire(&sync_lock);
+  while(i < last) {
+    size_t cnt = 0;
+
+    ft_lock_acquire();
+    while(cnt < SYNC_BATCH && i + cnt < last) {
+      struct sup_table_entry *spt = mmap->pages[i + cnt];
+
+      if(spt->ft == NULL || spt->ft->in_transit || spt->ft->pinned
+	 || !(pagedir_is_dirty(pd, spt->upage) || spt->modified)) {
+	break;
+      }
+
+      spt->ft->pinned = true;
+      pagedir_set_dirty(pd, spt->upage, false);
+      memcpy(sync_buffer + cnt * PGSIZE, ft_get_frame(spt->ft), PGSIZE);
+
+      /* A copy kept in swap from an earlier eviction is no longer needed */
+      if(spt->in_swap) {
+	swap_lock_acquire();
+	remove_swap_space(spt->block_number, 1);
+	swap_lock_release();
+	spt->in_swap = false;
+      }
+      spt->modified = false;
+      cnt++;
+    }
+    ft_lock_release();
+
+    if(cnt == 0) {
+      i++;
+      continue;
+    }
+
+    off_t bytes = (cnt - 1) * PGSIZE + mmap->pages[i + cnt - 1]->read_bytes;
+    off_t written = file_write_at(mmap->file, sync_buffer, bytes,
+				  i * PGSIZE);
+
+    ft_lock_acquire();
+    for(size_t j = 0; j < cnt; j++) {
+      struct sup_table_entry *spt = mmap->pages[i + j];
+      off_t end = (off_t) (j + 1) * PGSIZE < bytes ? (off_t) (j + 1) * PGSIZE
+						   : bytes;
+
+      if(written < end) {
+	spt->modified = true;
+      }
+      spt->ft->pinned = false;
+    }
+    ft_lock_release();
+
+    sync_write_cnt++;
+    sync_page_cnt += cnt;
+    i += cnt;
+  }
+  lock_release(&sync_lock);
+}
+
+/* Writes the dirty pages of a mapping that overlap a byte range back to
+   its file
+   Takes the mapping and the offset and length of the range in bytes
+   Returns false if the range starts outside the mapping */
+bool mmap_sync(struct mmap_entry *mmap, size_t offset, size_t length) {
+  if(mmap->pages == NULL || offset >= mmap->page_cnt * PGSIZE) {
+    return false;
+  }
+
+  size_t first = offset / PGSIZE;
+  size_t last = mmap->page_cnt;
+  if(length < mmap->page_cnt * PGSIZE - offset) {
+    last = DIV_ROUND_UP(offset + length, PGSIZE);
+  }
+
+  mmap_sync_pages(mmap, first, last);
+  return true;
+}
+
+/* Body of the background flusher thread, which periodically writes the
+   dirty pages of every mapping back so that unmapping and exiting do not
+   stall on them
+   Each pass takes the mappings in turn from the front of the list, moving
+   each to the back and marking it as being flushed, so that it is not
+   freed while written with the lock released */
+static void mmap_flusher(void *aux UNUSED) {
+  for(;;) {
+    timer_sleep(FLUSH_INTERVAL);
+
+    lock_acquire(&mapping_lock);
+    size_t cnt = list_size(&mapping_list);
+    while(cnt-- > 0 && !list_empty(&mapping_list)) {
+      struct mmap_entry *mmap = list_entry(list_pop_front(&mapping_list),
+					   struct mmap_entry, list_elem);
+      list_push_back(&mapping_list, &mmap->list_elem);
+      mmap->flushing = true;
+      lock_release(&mapping_lock);
+
+      mmap_sync_pages(mmap, 0, mmap->page_cnt);
+
+      lock_acquire(&mapping_lock);
+      mmap->flushing = false;
+      cond_broadcast(&flush_done, &mapping_lock);
+    }
+    lock_release(&mapping_lock);
+  }
+}
+
+/* Prints sync statistics */
+void mmap_print_stats(void) {
+  printf("Msync: %lld writes of %lld pages\n", sync_write_cnt, sync_page_cnt);
+}
+
+/* Writes a page of a mapping back to its file if it differs from it
+   The page is either loaded and dirty, in which case its frame is pinned
+   while it is written, or was sent to swap because the file could not be
+   written when it was evicted, in which case it is copied back through a
+   temporary kernel page and its swap slot freed
+   Either way the page matches its file afterwards, unless the file could
+   not be written, in which case the page stays modified
+   Takes the supplemental page table entry of the page */
+void mmap_write_page(struct sup_table_entry *spt) {
+  uint32_t *pd = spt->owner->pagedir;
+
+  ft_lock_acquire();
+  ft_wait_transit(spt);
+  struct frame_table_entry *ft = spt->ft;
+
+  if(ft != NULL) {
+    if(!pagedir_is_dirty(pd, spt->upage) && !spt->modified) {
+      ft_lock_release();
+      return;
+    }
+
+    ft->pinned = true;
+    pagedir_set_dirty(pd, spt->upage, false);
+    ft_lock_release();
+
+    off_t written = file_write_at(spt->file, ft_get_frame(ft),
+				  spt->read_bytes, spt->offset);
+
+    ft_lock_acquire();
+    ft->pinned = false;
+    if(written != spt->read_bytes) {
+      spt->modified = true;
+      ft_lock_release();
+      return;
+    }
+  } else if(spt->modified && spt->in_swap) {
+    ft_lock_release();
+
+    void *kpage = palloc_get_page(0);
+    if(kpage == NULL) {
+      return;
+    }
+
+    swap_lock_acquire();
+    swap_read_frame(kpage, spt->block_number);
+    swap_lock_release();
+
+    off_t written = file_write_at(spt->file, kpage, spt->read_bytes,
+				  spt->offset);
+    palloc_free_page(kpage);
+
+    /* The copy in swap is kept while the file does not hold the page */
+    if(written != spt->read_bytes) {
+      return;
+    }
+
+    ft_lock_acquire();
+  }
+
+  if(spt->in_swap) {
+    swap_lock_acquire();
+    remove_swap_space(spt->block_number, 1);
+    swap_lock_release();
+    spt->in_swap = false;
+  }
+  spt->modified = false;
+  ft_lock_release();
+}
+
 /* Removes a mmap entry from the table and frees it 
    Takes in the map_id of the entry to remove 
    Does nothing if the entry doesn't exist */
@@ -90,38 +366,41 @@ void mmap_remove_entry(struct mmap_entry *mmap, bool destroy) {
 
   struct thread *t = thread_current();
 
-  filesys_lock_acquire();
-  off_t length = file_length(mmap->file);
-  filesys_lock_release();
-  
-  size_t page_read_bytes;
-  off_t ofs = 0;
-  void *addr = mmap->addr;
-  while(length > 0) {
-    page_read_bytes = length < PGSIZE ? length : PGSIZE;	
+  /* Hide the mapping from the flusher, waiting for it to finish with the
+     mapping if it is writing it, then write back its loaded dirty pages in
+     batches */
+  if(mmap->pages != NULL) {
+    lock_acquire(&mapping_lock);
+    list_remove(&mmap->list_elem);
+    while(mmap->flushing) {
+      cond_wait(&flush_done, &mapping_lock);
+    }
+    lock_release(&mapping_lock);
+
+    mmap_sync_pages(mmap, 0, mmap->page_cnt);
+  }
 
-    if(pagedir_is_dirty(t->pagedir, addr)){
-      filesys_lock_acquire();
-      file_seek(mmap->file, ofs);
-      file_write(mmap->file, addr, page_read_bytes);
-      filesys_lock_release();
-    }    
+  /* Remove only the mapping's own pages, even if the file has grown since
+     it was mapped */
+  void *addr = mmap->addr;
+  for(size_t i = 0; i < mmap->page_cnt; i++) {
+    struct sup_table_entry *spt = spt_find_entry(t, addr);
 
-    spt_remove_entry(mmap->addr);   	
+    if(spt != NULL) {
+      mmap_write_page(spt);
+      spt_remove_entry(addr);
+    }
 
-    length -= PGSIZE;
-    ofs += PGSIZE;
     addr += PGSIZE;
   }
 
-  filesys_lock_acquire();
   file_close(mmap->file);
-  filesys_lock_release();
 
   if(!destroy) {
     hash_delete(&thread_current()->mmap_table, &mmap->elem);
   }
   
+  free(mmap->pages);
   free(mmap);
 }
 
@@ -2,8 +2,11 @@
 #define VM_MMAP
 
 #include <hash.h>
+#include <list.h>
 #include "filesys/file.h"
 
+struct sup_table_entry;
+
 #define ERROR_CODE (-1)
 
 /* Type used by identifiers in memory mapped files */
@@ -14,18 +17,35 @@ struct mmap_entry {
   mapid_t map_id;          /* The identifier of the map element */
   void *addr;              /* The virtual address of the mapped file */ 
   struct file *file;       /* Pointer to the file being mapped */
+  struct thread *owner;    /* Process that the mapping belongs to */
+  size_t page_cnt;         /* Number of pages in the mapping, counted as
+			      they are created */
+  struct sup_table_entry **pages; /* Entries of the mapping's pages, NULL
+				     until the mapping is complete */
   struct hash_elem elem;   /* A hash element used to track the mmap_elem */
+  struct list_elem list_elem; /* Element in the list of all mappings */
+  bool flushing;           /* True while the background flusher writes the
+			      mapping with the list's lock released */
 };
 
 /* Initialise mmap_table */
 void mmap_init(struct hash *);
 
+/* Initialise syncing of mappings and start the background flusher */
+void mmap_sync_init(void);
+
 /* Destroy mmap_table */
 void mmap_destroy(struct hash *);
 
 /* Manipulation of mmap_table */
 mapid_t mmap_create_entry(struct file *, void *);
 struct mmap_entry *mmap_find_entry(mapid_t);
+bool mmap_track_pages(mapid_t);
 void mmap_remove_entry(struct mmap_entry *, bool);
 
+/* Writing mappings back to their files */
+bool mmap_sync(struct mmap_entry *, size_t, size_t);
+void mmap_write_page(struct sup_table_entry *);
+void mmap_print_stats(void);
+
 #endif
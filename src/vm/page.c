@@ -1,27 +1,108 @@
 #include "vm/page.h"
 #include <debug.h>
 #include <stdio.h>
+#include <syscall-nr.h>
+#include <string.h>
+#include "threads/pte.h"
 #include "threads/vaddr.h"
+#include "threads/palloc.h"
 #include "threads/thread.h"
 #include "threads/malloc.h"
 #include "userprog/syscall.h"
 #include "userprog/process.h"
+#include "userprog/pagedir.h"
 #include "vm/frame.h"
+#include "vm/prefetch.h"
 #include "vm/swap.h"
 
-/* Hash Functions */
-static hash_hash_func spt_hash_uaddr;
-static hash_less_func spt_cmp_uaddr;
-static hash_action_func spt_destroy_entry;
+/* Number of leaves needed to cover user memory */
+#define SPT_LEAVES ((uintptr_t) PHYS_BASE / PTSPAN)
+
+static struct sup_table_entry *spt_new_entry(void *);
+static void spt_free_entry(struct thread *, struct sup_table_entry *);
+static void spt_destroy_entry(struct sup_table_entry *);
 
 /* Initialise sup_table */
-void spt_init(struct hash *sup_table) {
-  hash_init(sup_table, spt_hash_uaddr, spt_cmp_uaddr, NULL);
+void spt_init(struct sup_table *sup_table) {
+  sup_table->leaves = NULL;
+}
+
+/* Destroys entire supplemental page table, walking its pages in address
+   order */
+void spt_destroy(struct sup_table *sup_table) {
+  if(sup_table->leaves == NULL) {
+    return;
+  }
+
+  for(size_t l = 0; l < SPT_LEAVES; l++) {
+    struct spt_leaf *leaf = sup_table->leaves[l];
+
+    if(leaf == NULL) {
+      continue;
+    }
+
+    for(size_t c = 0; c < SPT_LEAF_CHUNKS; c++) {
+      for(size_t i = 0; i < SPT_CHUNK_PAGES; i++) {
+	if(leaf->used[c] & (1u << i)) {
+	  spt_destroy_entry(&leaf->chunks[c][i]);
+	}
+      }
+      free(leaf->chunks[c]);
+    }
+    free(leaf);
+  }
+
+  palloc_free_page(sup_table->leaves);
+  sup_table->leaves = NULL;
+}
+
+/* Finds where the entry of a page lives in the current thread's table,
+   allocating the parts of the table that are missing
+   Takes the user page, which must not have an entry
+   Returns the unused entry, or NULL if memory allocation fails */
+static struct sup_table_entry *spt_new_entry(void *upage) {
+  struct sup_table *sup_table = &thread_current()->sup_table;
+  size_t page = pt_no(upage);
+
+  if(sup_table->leaves == NULL) {
+    sup_table->leaves = palloc_get_page(PAL_ZERO);
+    if(sup_table->leaves == NULL) {
+      return NULL;
+    }
+  }
+
+  struct spt_leaf **leaf = &sup_table->leaves[pd_no(upage)];
+  if(*leaf == NULL) {
+    *leaf = calloc(1, sizeof **leaf);
+    if(*leaf == NULL) {
+      return NULL;
+    }
+  }
+
+  struct sup_table_entry **chunk = &(*leaf)->chunks[page / SPT_CHUNK_PAGES];
+  if(*chunk == NULL) {
+    *chunk = malloc(SPT_CHUNK_PAGES * sizeof **chunk);
+    if(*chunk == NULL) {
+      return NULL;
+    }
+  }
+
+  (*leaf)->used[page / SPT_CHUNK_PAGES] |= 1u << (page % SPT_CHUNK_PAGES);
+  return &(*chunk)[page % SPT_CHUNK_PAGES];
 }
 
-/* Destroys entire supplemental page table */
-void spt_destroy(struct hash *sup_table) {
-  hash_destroy(sup_table, spt_destroy_entry);
+/* Returns an entry's slot to the table of thread t, freeing its chunk once
+   the chunk has no entries left */
+static void spt_free_entry(struct thread *t, struct sup_table_entry *spt) {
+  struct spt_leaf *leaf = t->sup_table.leaves[pd_no(spt->upage)];
+  size_t page = pt_no(spt->upage);
+  size_t c = page / SPT_CHUNK_PAGES;
+
+  leaf->used[c] &= ~(1u << (page % SPT_CHUNK_PAGES));
+  if(leaf->used[c] == 0) {
+    free(leaf->chunks[c]);
+    leaf->chunks[c] = NULL;
+  }
 }
 
 /* Creates a supplemental page table for a file page
@@ -65,12 +146,11 @@ bool create_file_page(void *upage, struct file *file, off_t offset,
   }
 
   /* Creates new table entry with given values if one cannot be found */
-  spt = malloc(sizeof(struct sup_table_entry));
+  spt = spt_new_entry(upage);
 
   if(spt == NULL) {
     return false;
   }
-  create_alloc_elem(spt, MALLOC_PTR);
 
   spt->file = file;
   spt->offset = offset;
@@ -80,12 +160,12 @@ bool create_file_page(void *upage, struct file *file, off_t offset,
   spt->owner = thread_current();
   spt->writable = writable;
   spt->modified = false;
+  spt->in_swap = false;
+  spt->prefetched = false;
+  spt->zero_mapped = false;
   spt->accessed = false;
-  spt->pinned = false;
+  spt->advice = MADV_NORMAL;
   spt->type = type;
-  
-  hash_insert(&thread_current()->sup_table, &spt->elem);
-  remove_alloc_elem(spt);
 
   return true;
 }
@@ -93,55 +173,48 @@ bool create_file_page(void *upage, struct file *file, off_t offset,
 /* Creates a supplemental page table for a stack page
    Takes the user virtual address of the stack page */
 void create_stack_page(void *upage) {		      
-  struct sup_table_entry *spt = malloc(sizeof(struct sup_table_entry));  
+  struct sup_table_entry *spt = spt_new_entry(upage);
   if(spt == NULL) {
     thread_exit();
   }
-  create_alloc_elem(spt, MALLOC_PTR);
   
   spt->file = NULL;
   spt->offset = 0;
+  spt->read_bytes = 0;
   spt->upage = pg_round_down(upage);
   spt->owner = thread_current();
   spt->writable = true;
   spt->modified = false;
+  spt->in_swap = false;
+  spt->prefetched = false;
+  spt->zero_mapped = false;
+  spt->accessed = false;
+  spt->advice = MADV_NORMAL;
   spt->type = NEW_STACK_PAGE;
   spt->ft = NULL;
-
-  hash_insert(&thread_current()->sup_table, &spt->elem);
-  remove_alloc_elem(spt);
-}
-
-/* Calculates a hash value based on user page address of e */
-static unsigned spt_hash_uaddr(const struct hash_elem *e, void *aux UNUSED) {
-  struct sup_table_entry *spt = hash_entry(e, struct sup_table_entry, elem);
-  
-  return hash_int((int) spt->upage);
-}
-
-/* Compares entries on numerical value of user page address */ 
-static bool spt_cmp_uaddr(const struct hash_elem *a, const struct hash_elem *b,
-		   void *aux UNUSED) {
-  struct sup_table_entry *spt1 = hash_entry(a, struct sup_table_entry, elem);
-  struct sup_table_entry *spt2 = hash_entry(b, struct sup_table_entry, elem);
-  
-  return spt1->upage < spt2->upage;
 }
 
 /* Finds entry corresponding to a given page in the supplemental page table 
    Takes in a thread with sup_table to search and a user page to search for 
    Returns the page entry struct if found or NULL otherwise */
 struct sup_table_entry *spt_find_entry(struct thread *t, const void *uaddr) {
-  struct sup_table_entry key;
-  key.upage = pg_round_down(uaddr);
-  
-  struct hash_elem *elem = hash_find(&t->sup_table, &key.elem);
+  struct spt_leaf **leaves = t->sup_table.leaves;
 
-  if(elem == NULL) {
+  if(leaves == NULL || !is_user_vaddr(uaddr)) {
     return NULL;
   }
-  
-  return hash_entry(elem, struct sup_table_entry, elem);
+
+  struct spt_leaf *leaf = leaves[pd_no(uaddr)];
+  if(leaf == NULL) {
+    return NULL;
+  }
+
+  size_t page = pt_no(uaddr);
+  if(!(leaf->used[page / SPT_CHUNK_PAGES] & (1u << (page % SPT_CHUNK_PAGES)))) {
+    return NULL;
+  }
+
+  return &leaf->chunks[page / SPT_CHUNK_PAGES][page % SPT_CHUNK_PAGES];
 }
 
 /* Removes a supplemental page table entry at given page and frees its memory
@@ -153,65 +226,46 @@ void spt_remove_entry(void *uaddr) {
   struct sup_table_entry *spt = spt_find_entry(thread_current(), uaddr);
 
   if(spt != NULL) {
-    hash_delete(&t->sup_table, &spt->elem);
-    spt_destroy_entry(&spt->elem, NULL);
+    spt_destroy_entry(spt);
+    spt_free_entry(t, spt);
   }
 }
 
-/* Frees a supplemental page table entry at given page
+/* Releases what a supplemental page table entry holds, before its slot
+   is freed
    Clears any swap space allocated to the provided virtual page
-   Removes frame table entry at the same user virtual address if it exists
-   To be used in hash_destroy to delete all supplemental page table entries */
-static void spt_destroy_entry(struct hash_elem *e, void *aux UNUSED) {
-  struct sup_table_entry *spt = hash_entry(e, struct sup_table_entry, elem);
+   Removes frame table entry at the same user virtual address if this was
+   its last owner */
+static void spt_destroy_entry(struct sup_table_entry *spt) {
 
-  /* Removes frame table entry of the page if it is in physical memory */
+  /* Removes frame table entry of the page if it is in physical memory,
+     once any thread evicting it has finished with it */
   ft_lock_acquire();
+  ft_wait_transit(spt);
   struct frame_table_entry *ft = spt->ft;
   
   if(ft != NULL) {
-    /* If page is a modified file in frame, read it back to the file */
-    if(ft->modified &&
-       (spt->type == FILE_PAGE || spt->type == ZERO_PAGE)) {
-      filesys_lock_acquire();
-      file_seek(spt->file, spt->offset);
-      file_write(spt->file, ft->frame, PGSIZE);
-      filesys_lock_release();
+    /* Unmap the page so the owner cannot reach the frame once it is freed */
+    uint32_t *pd = spt->owner->pagedir;
+    if(pd != NULL) {
+      prefetch_account(spt, pagedir_is_accessed(pd, spt->upage));
+      pagedir_clear_page(pd, spt->upage);
     }
 
     /* Remove self from frame's owners list and free if it has no owners */
-    //lock_acquire(&ft->owners_lock);
-    list_remove(&spt->frame_elem);
+    ft_remove_owner(ft, spt);
     
-    if (list_empty(&ft->owners)) {
-      ft_remove_entry(ft->frame);
-    } else {
-      //lock_release(&ft->owners_lock);
+    if(ft->owners == NULL) {
+      ft_remove_entry(ft_get_frame(ft));
     }
-  } else {
-    /* If page in swap system, read it back to its file and free swap space */
-    if(spt->type == IN_SWAP_FILE) {
-      
-      filesys_lock_acquire();
-      file_seek(spt->file, spt->offset);
-      
-      swap_lock_acquire();
-      swap_read_file(spt->file, spt->block_number, spt->read_bytes);
-      swap_lock_release();
+  }
 
-      filesys_lock_release();
-    }
-    
-    /* Clear swap space if page is found in swap space */
-    if (spt->type == IN_SWAP_FILE || spt->type == STACK_PAGE
-	|| (spt->type == MMAPPED_PAGE && spt->modified)) {
-      swap_lock_acquire();
-      remove_swap_space(spt->block_number, 1);
-      swap_lock_release();
-    }
+  if(spt->in_swap) {
+    /* Clear swap space if page has a copy in swap space */
+    swap_lock_acquire();
+    remove_swap_space(spt->block_number, 1);
+    swap_lock_release();
   }
 
   ft_lock_release();
-
-  free(spt);
 }
@@ -1,41 +1,92 @@
 #ifndef VM_PAGE
 #define VM_PAGE
 
-#include <hash.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include "filesys/file.h"
-#include "threads/thread.h"
+
+struct thread;
 
 /* Enum to determine the type of virtual page and storage space */
 enum sup_entry_type {
-  ZERO_PAGE,               /* Empty file page, either in frame or not stored */
+  ZERO_PAGE,               /* Empty file page, either in frame, mapped to
+			      the zero frame or not stored */
   FILE_PAGE,               /* Data is a file in filesys or frame */
   IN_SWAP_FILE,            /* Data is a file in swap space */
   STACK_PAGE,		   /* Data is a stack page, in frame or in swap */
   MMAPPED_PAGE,		   /* Data is in memory map, in frame or in swap */
-  NEW_STACK_PAGE           /* Empty stack page, not stored */
+  NEW_STACK_PAGE           /* Empty stack page, not stored or mapped to the
+			      zero frame */
 };
 
-/* Entry representing a virtual page in the suplemental page table */
+/* Entry representing a virtual page in the suplemental page table
+   Kept to 32 bytes as entries are allocated in chunks for runs of pages
+   The type and flags are bit-fields in two bytes, one written only with the
+   frame table lock held and one only by the owning thread, as bit-fields in
+   the same byte cannot be written independently. Either may also be
+   written without the lock before the page is first given a frame */
 struct sup_table_entry {
   size_t block_number;	        /* Block number of swap space data if present */
   struct file *file;            /* File pointer */
   off_t offset;	                /* Offset of page data in file */
-  size_t read_bytes;            /* Number of bytes to be read from file */
   void *upage;                  /* User page the entry represents */
   struct frame_table_entry *ft; /* Frame where page is loaded, 
 				   NULL if not loaded */
-  struct list_elem frame_elem;  /* Used to insert into frame's owners list */
+  struct sup_table_entry *next_owner; /* Next owner of the same frame */
   struct thread *owner;		/* Pointer to thread which owns this sup table */
-  bool writable;                /* Whether data is writable */
-  bool modified;		/* Whether data was modified */
-  bool accessed;                /* Whether data was accessed */
-  bool pinned;                  /* Whether the frame must be pinned on allocation */
-  struct hash_elem elem;        /* Used to store in supplemental page table */
-  enum sup_entry_type type;     /* Type of entry (see enum above) */
+  uint16_t read_bytes;          /* Number of bytes to be read from file */
+
+  /* Written with the frame table lock held */
+  enum sup_entry_type type : 3; /* Type of entry (see enum above) */
+  bool modified : 1;		/* Whether data was modified */
+  bool in_swap : 1;             /* Whether block_number holds an up to date
+				   copy of the data, kept after swap in until
+				   the page is dirtied */
+  bool accessed : 1;            /* Whether data was accessed */
+  bool prefetched : 1;          /* Whether the page was read ahead and has
+				   not been accounted as a hit or miss */
+
+  /* Written by the owning thread */
+  uint8_t : 0;
+  bool writable : 1;            /* Whether data is writable */
+  bool zero_mapped : 1;         /* Whether the page is mapped read only to
+				   the shared zero frame until written */
+  unsigned advice : 2;          /* Access pattern given with madvise, one of
+				   MADV_NORMAL, MADV_SEQUENTIAL or MADV_RANDOM */
+};
+
+/* Pages covered by one chunk of entries, and chunks in a 4 MiB region */
+#define SPT_CHUNK_PAGES (32)
+#define SPT_LEAF_CHUNKS (1024 / SPT_CHUNK_PAGES)
+
+/* Second level of the supplemental page table, covering the 4 MiB of user
+   memory mapped by one page table
+   Entries are allocated a chunk at a time for runs of SPT_CHUNK_PAGES
+   pages, and never move once allocated */
+struct spt_leaf {
+  uint32_t used[SPT_LEAF_CHUNKS]; /* Bit for every page with an entry */
+  struct sup_table_entry *chunks[SPT_LEAF_CHUNKS]; /* Entries of each run of
+						      pages, NULL if none */
+};
+
+/* Supplemental page table, shaped like the page directory */
+struct sup_table {
+  struct spt_leaf **leaves;     /* Leaf for every 4 MiB region of user
+				   memory, NULL if it has no pages
+				   The array is allocated on first use */
+};
+
+/* Range of user pages a thread has pinned for a system call, so that
+   their frames are not evicted while the call accesses them */
+struct pin_range {
+  void *start;                  /* First page pinned */
+  void *end;                    /* Page after the last pinned, equal to
+				   start if none are */
 };
 
 /* Initialise sup_table */
-void spt_init(struct hash *);
+void spt_init(struct sup_table *);
 
 /* Manipulation of sup_table */
 bool create_file_page(void *, struct file *, off_t, bool, size_t,
@@ -43,6 +94,6 @@ bool create_file_page(void *, struct file *, off_t, bool, size_t,
 void create_stack_page(void *);
 struct sup_table_entry *spt_find_entry(struct thread *, const void *);
 void spt_remove_entry(void *);
-void spt_destroy(struct hash *);
+void spt_destroy(struct sup_table *);
 
 #endif
@@ -0,0 +1,97 @@
+#include "vm/pageout.h"
+#include <debug.h>
+#include <round.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "vm/frame.h"
+
+/* Default low watermark as a fraction of the user pool */
+#define DEFAULT_LOW_DIVISOR (64)
+
+/* Page-out daemon
+   Sleeps until the number of free user frames drops below low_watermark,
+   then evicts frames until high_watermark frames are free again, so that
+   page faults normally find a free frame without evicting one themselves */
+static size_t low_watermark;
+static size_t high_watermark;
+static struct semaphore pageout_sema;
+static bool pageout_pending;
+
+/* Page-out statistics */
+static long long wakeup_cnt;
+static long long reclaim_cnt;
+
+static thread_func pageout_daemon NO_RETURN;
+
+/* Starts the page-out daemon
+   Takes the low and high watermarks in pages, where SIZE_MAX selects a
+   default derived from the size of the user pool and a low watermark of 0
+   disables the daemon */
+void pageout_init(size_t low, size_t high) {
+  void *base;
+  size_t frame_cnt;
+  palloc_get_user_pool(&base, &frame_cnt);
+
+  if(low == SIZE_MAX) {
+    low = DIV_ROUND_UP(frame_cnt, DEFAULT_LOW_DIVISOR);
+  }
+  if(high == SIZE_MAX || high < low) {
+    high = 2 * low;
+  }
+
+  /* Never try to keep the whole pool free */
+  low_watermark = low < frame_cnt ? low : frame_cnt / 2;
+  high_watermark = high < frame_cnt ? high : frame_cnt / 2;
+
+  sema_init(&pageout_sema, 0);
+  pageout_pending = false;
+
+  if(low_watermark > 0) {
+    thread_create("pageout", PRI_DEFAULT, pageout_daemon, NULL);
+  }
+}
+
+/* Wakes the page-out daemon if the user pool is below its low watermark */
+void pageout_check(void) {
+  if(!pageout_pending && palloc_user_free_cnt() < low_watermark) {
+    pageout_pending = true;
+    sema_up(&pageout_sema);
+  }
+}
+
+/* Body of the page-out daemon thread */
+static void pageout_daemon(void *aux UNUSED) {
+  for(;;) {
+    sema_down(&pageout_sema);
+    wakeup_cnt++;
+
+    size_t free_cnt;
+    while((free_cnt = palloc_user_free_cnt()) < high_watermark) {
+      void *kpages[EVICT_BATCH];
+      size_t cnt = high_watermark - free_cnt;
+
+      cnt = ft_evict_frames(kpages, cnt < EVICT_BATCH ? cnt : EVICT_BATCH,
+			    NULL);
+
+      if(cnt == 0) {
+	break;
+      }
+
+      for(size_t i = 0; i < cnt; i++) {
+	palloc_free_page(kpages[i]);
+      }
+      reclaim_cnt += cnt;
+    }
+
+    pageout_pending = false;
+  }
+}
+
+/* Prints page-out statistics */
+void pageout_print_stats(void) {
+  printf("Pageout: %lld wakeups, %lld frames reclaimed\n",
+	 wakeup_cnt, reclaim_cnt);
+}
@@ -0,0 +1,10 @@
+#ifndef VM_PAGEOUT
+#define VM_PAGEOUT
+
+#include <stddef.h>
+
+void pageout_init(size_t, size_t);
+void pageout_check(void);
+void pageout_print_stats(void);
+
+#endif
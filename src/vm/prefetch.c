@@ -0,0 +1,177 @@
+#include "vm/prefetch.h"
+#include <debug.h>
+#include <stdio.h>
+#include <string.h>
+#include <syscall-nr.h>
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/exception.h"
+#include "userprog/process.h"
+#include "userprog/syscall.h"
+#include "vm/frame.h"
+#include "vm/page.h"
+
+/* Bounds of the read-ahead window in pages */
+#define MIN_WINDOW (2)
+#define MAX_WINDOW (16)
+
+/* Prefetch statistics */
+static long long prefetch_cnt;
+static long long hit_cnt;
+static long long miss_cnt;
+
+static struct prefetch_stream *find_stream(struct file *);
+static bool can_prefetch(struct sup_table_entry *, struct file *, off_t);
+
+/* Gets the read-ahead state of the mapping of file in the current thread,
+   recycling the least recently faulted one if there is none
+   The streams are kept in most recently faulted order */
+static struct prefetch_stream *find_stream(struct file *file) {
+  struct prefetch_stream *streams = thread_current()->prefetch;
+  struct prefetch_stream found;
+  size_t i;
+
+  for(i = 0; i < PREFETCH_STREAMS - 1; i++) {
+    if(streams[i].file == file) {
+      break;
+    }
+  }
+
+  found = streams[i];
+  if(found.file != file) {
+    found.file = file;
+    found.next_offset = -1;
+    found.window = 0;
+  }
+
+  memmove(streams + 1, streams, i * sizeof *streams);
+  streams[0] = found;
+  return &streams[0];
+}
+
+/* Returns whether the page of spt can be read ahead as the page at offset
+   of file, which it must not be loaded and must be read from the file */
+static bool can_prefetch(struct sup_table_entry *spt, struct file *file,
+			 off_t offset) {
+  if(spt == NULL || spt->ft != NULL || spt->in_swap
+     || spt->file != file || spt->offset != offset) {
+    return false;
+  }
+
+  if(spt->type == MMAPPED_PAGE) {
+    return !spt->modified;
+  }
+
+  if(spt->type != FILE_PAGE) {
+    return false;
+  }
+
+  /* A read only page that is already shared is installed on its own
+     fault without any I/O */
+  if(!spt->writable) {
+    bool lock_held = st_lock_held_by_current_thread();
+
+    run_if_false(st_lock_acquire(), lock_held);
+    bool shared = st_find_entry(file, offset) != NULL;
+    run_if_false(st_lock_release(), lock_held);
+
+    return !shared;
+  }
+  return true;
+}
+
+/* Reads ahead of a page just loaded from its file on a fault 
+   The window grows while faults on the mapping are sequential and shrinks
+   when they are not, and is as large as it can be from the start for pages
+   advised to be sequential. Pages advised to be random are never read
+   ahead. Following pages of the same mapping are loaded into free frames
+   only, never by evicting
+   Takes the supplemental page table entry of the faulting page */
+void prefetch_around(struct sup_table_entry *spt) {
+  struct thread *t = thread_current();
+  struct prefetch_stream *s = find_stream(spt->file);
+  struct sup_table_entry *pages[MAX_WINDOW];
+  void *frames[MAX_WINDOW];
+  size_t cnt;
+
+  if(spt->advice == MADV_RANDOM) {
+    return;
+  }
+
+  if(spt->advice == MADV_SEQUENTIAL) {
+    s->window = MAX_WINDOW;
+  } else if(spt->offset == s->next_offset) {
+    s->window = s->window == 0 ? MIN_WINDOW : s->window * 2;
+    if(s->window > MAX_WINDOW) {
+      s->window = MAX_WINDOW;
+    }
+  } else {
+    s->window /= 2;
+  }
+
+  /* Load the following pages into free frames and pin them until read */
+  for(cnt = 0; cnt < s->window; cnt++) {
+    off_t offset = spt->offset + (cnt + 1) * PGSIZE;
+    void *upage = spt->upage + (cnt + 1) * PGSIZE;
+
+    if(!is_user_vaddr(upage)) {
+      break;
+    }
+
+    struct sup_table_entry *next = spt_find_entry(t, upage);
+    if(!can_prefetch(next, spt->file, offset)) {
+      break;
+    }
+
+    void *frame = try_allocate_user_page(upage, 0, next->writable);
+    if(frame == NULL) {
+      break;
+    }
+
+    pages[cnt] = next;
+    frames[cnt] = frame;
+  }
+
+  if(cnt > 0) {
+    for(size_t i = 0; i < cnt; i++) {
+      off_t bytes_read = file_read_at(spt->file, frames[i],
+				      pages[i]->read_bytes, pages[i]->offset);
+      memset(frames[i] + bytes_read, 0, PGSIZE - bytes_read);
+      if(pages[i]->type == FILE_PAGE && !pages[i]->writable) {
+	share_page(pages[i]);
+      }
+    }
+
+    ft_lock_acquire();
+    for(size_t i = 0; i < cnt; i++) {
+      pages[i]->prefetched = true;
+      pages[i]->ft->pinned = false;
+    }
+    ft_lock_release();
+
+    prefetch_cnt += cnt;
+  }
+
+  s->next_offset = spt->offset + (cnt + 1) * PGSIZE;
+}
+
+/* Records whether a page that was read ahead was used before it was
+   evicted or unmapped
+   Takes the supplemental page table entry and whether it was accessed,
+   and does nothing unless the page was read ahead and not yet accounted */
+void prefetch_account(struct sup_table_entry *spt, bool accessed) {
+  if(spt->prefetched) {
+    spt->prefetched = false;
+    if(accessed) {
+      hit_cnt++;
+    } else {
+      miss_cnt++;
+    }
+  }
+}
+
+/* Prints prefetch statistics */
+void prefetch_print_stats(void) {
+  printf("Prefetch: %lld pages read ahead, %lld hits, %lld misses\n",
+	 prefetch_cnt, hit_cnt, miss_cnt);
+}
@@ -0,0 +1,24 @@
+#ifndef VM_PREFETCH
+#define VM_PREFETCH
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "filesys/off_t.h"
+
+/* Number of mappings per process whose faults are tracked for read-ahead */
+#define PREFETCH_STREAMS (4)
+
+/* Read-ahead state of one file mapping of a process */
+struct prefetch_stream {
+  struct file *file;       /* File of the mapping, NULL if unused */
+  off_t next_offset;       /* Offset at which a sequential fault is expected */
+  size_t window;           /* Pages read ahead on the last fault */
+};
+
+struct sup_table_entry;
+
+void prefetch_around(struct sup_table_entry *);
+void prefetch_account(struct sup_table_entry *, bool);
+void prefetch_print_stats(void);
+
+#endif
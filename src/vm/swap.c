@@ -1,76 +1,140 @@
 #include "vm/swap.h"
 #include <bitmap.h>
 #include <stddef.h>
+#include <string.h>
 #include "threads/malloc.h"
+#include "threads/palloc.h"
 #include "threads/vaddr.h"
 #include "threads/synch.h"
 #include "devices/block.h"
 #include "filesys/file.h"
 #include "vm/frame.h"
+#include "vm/zswap.h"
 
 /* Swap table */
 struct bitmap *swap_table;
 static struct lock swap_table_lock;
+static size_t swap_cursor;      /* Sector the next search starts from */
+
+/* Staging buffer that a cluster of frames is gathered into so that it
+   can be written with a single transfer, and its lock */
+static void *cluster_buffer;
+static struct lock cluster_lock;
 
 /* Initialises swap table and swap lock */
 void swap_init() {
   swap_table = bitmap_create(block_size(block_get_role(BLOCK_SWAP)));
   lock_init(&swap_table_lock);
+  swap_cursor = 0;
+  cluster_buffer = palloc_get_multiple(PAL_ASSERT, SWAP_CLUSTER);
+  lock_init(&cluster_lock);
 }
 
 /* Finds space in swap table for cnt adjascent pages 
    Returns the index of the first sector of the allocated swap space
    MUST ACQUIRE THE SWAP TABLE LOCK BEFORE CALLING */
 size_t find_swap_space(size_t cnt) {
-  return bitmap_scan_and_flip(swap_table, 0,
-		  cnt * PGSIZE / BLOCK_SECTOR_SIZE, false);
+  return bitmap_scan_and_flip_next(swap_table, &swap_cursor,
+				   cnt * SECTORS_PER_PAGE, false);
 }
 
 /* Frees space for cnt pages starting from sector index start
    Takes a starting sector index and a number of pages to remove 
    MUST ACQUIRE THE SWAP TABLE LOCK BEFORE CALLING */
 void remove_swap_space(size_t start, size_t cnt) {
-  bitmap_set_multiple(swap_table, start,
-		  cnt * PGSIZE / BLOCK_SECTOR_SIZE, false);
+  for(size_t i = 0; i < cnt; i++) {
+    zswap_invalidate(start + i * SECTORS_PER_PAGE);
+  }
+  bitmap_set_multiple(swap_table, start, cnt * SECTORS_PER_PAGE, false);
 }
 
-/* Writes a frame of data into the swap space 
-   Takes the frame to write and the start sector to write to
+/* Writes cnt contiguous pages of data into the swap space with a single
+   ranged block transfer
+   Takes the buffer to write, the start sector and a number of pages
+   MUST RESERVE THE SLOTS AND PIN BEFORE CALLING */
+void swap_write_pages(const void *buffer, size_t start, size_t cnt) {
+  block_write_multiple(block_get_role(BLOCK_SWAP), start,
+		  cnt * SECTORS_PER_PAGE, buffer);
+}
+
+/* Reads cnt contiguous pages of data from the swap space with a single
+   ranged block transfer
+   Takes the buffer to read into, the start sector and a number of pages
    MUST ACQUIRE THE SWAP TABLE LOCK AND PIN BEFORE CALLING */
-void swap_write_frame(void *frame, size_t start) {
-  struct block *b = block_get_role(BLOCK_SWAP);
+void swap_read_pages(void *buffer, size_t start, size_t cnt) {
+  block_read_multiple(block_get_role(BLOCK_SWAP), start,
+		  cnt * SECTORS_PER_PAGE, buffer);
+}
+
+/* Writes cnt frames straight to consecutive pages of the swap device
+   The frames are gathered into the cluster buffer and written as one
+   sequential transfer. If another thread is using the buffer they are
+   written from where they are instead, frames that are next to each other
+   in memory together
+   MUST RESERVE THE SLOTS AND PIN BEFORE CALLING */
+static void swap_write_run(void **frames, size_t cnt, size_t start) {
+  ASSERT(cnt <= SWAP_CLUSTER);
 
-  for (block_sector_t i = start; i < start + PGSIZE / BLOCK_SECTOR_SIZE; i++) {
-    block_write(b, i, (frame + (i - start) * BLOCK_SECTOR_SIZE));
+  if(cnt > 1 && lock_try_acquire(&cluster_lock)) {
+    for(size_t i = 0; i < cnt; i++) {
+      memcpy(cluster_buffer + i * PGSIZE, frames[i], PGSIZE);
+    }
+    swap_write_pages(cluster_buffer, start, cnt);
+    lock_release(&cluster_lock);
+    return;
   }
-}
 
-/* Reads a page of data into a frame from the swap space 
-   Takes the frame to write to and the start sector to read from
-   MUST ACQUIRE THE SWAP TABLE LOCK AND PIN BEFORE CALLING */
-void swap_read_frame(void *frame, size_t start) {
-  struct block *b = block_get_role(BLOCK_SWAP);
-  
-  for (block_sector_t i = start; i < start + PGSIZE / BLOCK_SECTOR_SIZE; i++) {
-    block_read(b, i, (frame + (i - start) * BLOCK_SECTOR_SIZE));
+  size_t first = 0;
+  for(size_t i = 1; i <= cnt; i++) {
+    if(i == cnt || frames[i] != frames[i - 1] + PGSIZE) {
+      swap_write_pages(frames[first], start + first * SECTORS_PER_PAGE,
+		       i - first);
+      first = i;
+    }
   }
 }
 
-/* Reads a page of data from swap space into a given file 
-   Takes a file to write into and a sector index to read from
-   MUST ACQUIRE THE FILESYS AND SWAP TABLE LOCKS BEFORE CALLING */
-void swap_read_file(struct file *file, size_t start, size_t read_bytes){
-  uint8_t *buffer[BLOCK_SECTOR_SIZE];
-  struct block *b = block_get_role(BLOCK_SWAP);
-  block_sector_t i;
-
-  for (i = start; i < start + read_bytes / BLOCK_SECTOR_SIZE; i++) {
-    block_read(b, i, buffer);
-    file_write(file, buffer, BLOCK_SECTOR_SIZE);
+/* Writes cnt frames into consecutive pages of the swap space
+   Frames taken by the compressed swap cache are not written to the swap
+   device, the rest are written in runs of consecutive pages. The swap
+   lock is only held for the cache, so that threads evicting at the same
+   time can write to the device at the same time
+   Takes the frames to write, how many there are, at most SWAP_CLUSTER,
+   and the start sector to write to
+   MUST RESERVE THE SLOTS AND PIN BEFORE CALLING, WITHOUT THE SWAP LOCK */
+void swap_write_frames(void **frames, size_t cnt, size_t start) {
+  size_t first = 0;
+
+  for(size_t i = 0; i < cnt; i++) {
+    swap_lock_acquire();
+    bool stored = zswap_store(frames[i], start + i * SECTORS_PER_PAGE);
+    swap_lock_release();
+
+    if(stored) {
+      swap_write_run(frames + first, i - first,
+		     start + first * SECTORS_PER_PAGE);
+      first = i + 1;
+    }
   }
+  swap_write_run(frames + first, cnt - first,
+		 start + first * SECTORS_PER_PAGE);
+}
+
+/* Writes a frame of data into the swap space 
+   Takes the frame to write and the start sector to write to
+   MUST RESERVE THE SLOT AND PIN BEFORE CALLING, WITHOUT THE SWAP LOCK */
+void swap_write_frame(void *frame, size_t start) {
+  swap_write_frames(&frame, 1, start);
+}
 
-  block_read(b, i, buffer);
-  file_write(file, buffer, read_bytes % BLOCK_SECTOR_SIZE);
+/* Reads a page of data into a frame from the compressed swap cache or
+   the swap space
+   Takes the frame to write to and the start sector to read from
+   MUST ACQUIRE THE SWAP TABLE LOCK AND PIN BEFORE CALLING */
+void swap_read_frame(void *frame, size_t start) {
+  if(!zswap_load(frame, start)) {
+    swap_read_pages(frame, start, 1);
+  }
 }
 
 /* Acquire the swap table lock */
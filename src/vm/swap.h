@@ -2,13 +2,23 @@
 #define VM_SWAP
 #include <bitmap.h>
 #include <stddef.h>
+#include "threads/vaddr.h"
+#include "devices/block.h"
+
+/* Number of swap sectors backing one page */
+#define SECTORS_PER_PAGE (PGSIZE / BLOCK_SECTOR_SIZE)
+
+/* Most pages written to swap in a single transfer */
+#define SWAP_CLUSTER 8
 
 void swap_init(void);
 size_t find_swap_space(size_t);
 void remove_swap_space(size_t, size_t);
+void swap_write_pages(const void *, size_t, size_t);
+void swap_read_pages(void *, size_t, size_t);
+void swap_write_frames(void **, size_t, size_t);
 void swap_write_frame(void *, size_t);
 void swap_read_frame(void *, size_t);
-void swap_read_file(struct file *, size_t, size_t);
 void swap_lock_acquire(void);
 void swap_lock_release(void);
 bool swap_lock_held_by_current_thread(void);
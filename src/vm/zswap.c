@@ -0,0 +1,190 @@
+#include "vm/zswap.h"
+#include <debug.h>
+#include <hash.h>
+#include <list.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+#include "vm/compress.h"
+#include "vm/swap.h"
+
+/* Largest compressed page worth keeping in memory, anything bigger goes
+   straight to the swap device */
+#define ZSWAP_MAX_SIZE (PGSIZE * 3 / 4)
+
+/* Compressed swap cache
+   Holds compressed copies of pages written to swap, keyed by their swap
+   slot, so that refaults can be served from memory. The slot stays
+   allocated in the swap table while its page is cached, and the page is
+   only written to the swap device when the cache overflows and it is the
+   oldest entry. All functions MUST BE CALLED WITH THE SWAP TABLE LOCK */
+struct zswap_entry {
+  size_t slot;                  /* First swap sector of the page */
+  size_t size;                  /* Bytes of compressed data */
+  struct hash_elem elem;        /* Element in zswap_table */
+  struct list_elem lru_elem;    /* Element in zswap_lru, oldest first */
+  uint8_t data[];               /* Compressed page */
+};
+
+static bool enabled;
+static struct hash zswap_table;
+static struct list zswap_lru;
+static size_t capacity;         /* Most bytes of compressed data to hold */
+static size_t used;             /* Bytes of compressed data held */
+
+static uint8_t *compress_buffer; /* Scratch space for compressing a page */
+static void *writeback_page;     /* Page decompressed for writing back */
+
+/* Swap cache statistics */
+static long long store_cnt;
+static long long reject_cnt;
+static long long hit_cnt;
+static long long miss_cnt;
+static long long writeback_cnt;
+
+static hash_hash_func hash_slot;
+static hash_less_func cmp_slot;
+static struct zswap_entry *zswap_find(size_t);
+static void zswap_remove(struct zswap_entry *);
+static void zswap_writeback(void);
+
+/* Initialises the compressed swap cache
+   Takes the most memory to use for compressed pages, in pages, where 0
+   leaves the cache disabled */
+void zswap_init(size_t page_cnt) {
+  if(page_cnt == 0) {
+    return;
+  }
+
+  hash_init(&zswap_table, hash_slot, cmp_slot, NULL);
+  list_init(&zswap_lru);
+  capacity = page_cnt * PGSIZE;
+  used = 0;
+  compress_buffer = palloc_get_page(PAL_ASSERT);
+  writeback_page = palloc_get_page(PAL_ASSERT);
+  enabled = true;
+}
+
+/* Hashes a cache entry on its swap slot */
+static unsigned hash_slot(const struct hash_elem *e, void *aux UNUSED) {
+  struct zswap_entry *z = hash_entry(e, struct zswap_entry, elem);
+
+  return hash_bytes(&z->slot, sizeof z->slot);
+}
+
+/* Compares two cache entries on their swap slots */
+static bool cmp_slot(const struct hash_elem *a, const struct hash_elem *b,
+		     void *aux UNUSED) {
+  return hash_entry(a, struct zswap_entry, elem)->slot
+    < hash_entry(b, struct zswap_entry, elem)->slot;
+}
+
+/* Gets the cache entry for a swap slot, or NULL if it is not cached */
+static struct zswap_entry *zswap_find(size_t slot) {
+  struct zswap_entry key;
+  key.slot = slot;
+
+  struct hash_elem *e = hash_find(&zswap_table, &key.elem);
+  return e != NULL ? hash_entry(e, struct zswap_entry, elem) : NULL;
+}
+
+/* Removes an entry from the cache and frees it */
+static void zswap_remove(struct zswap_entry *z) {
+  hash_delete(&zswap_table, &z->elem);
+  list_remove(&z->lru_elem);
+  used -= z->size;
+  free(z);
+}
+
+/* Writes the oldest cached page to its slot on the swap device and drops
+   it from the cache */
+static void zswap_writeback(void) {
+  struct zswap_entry *z =
+    list_entry(list_front(&zswap_lru), struct zswap_entry, lru_elem);
+
+  decompress_page(z->data, z->size, writeback_page);
+  swap_write_pages(writeback_page, z->slot, 1);
+  zswap_remove(z);
+  writeback_cnt++;
+}
+
+/* Compresses a page into the cache in place of writing it to swap 
+   Takes the page and the swap slot allocated for it, writing older pages
+   back to the swap device if the cache is full
+   Returns false if the page was not cached and must be written to the
+   swap device by the caller */
+bool zswap_store(const void *page, size_t slot) {
+  if(!enabled) {
+    return false;
+  }
+
+  size_t size = compress_page(page, compress_buffer, ZSWAP_MAX_SIZE);
+  if(size == 0 || size > capacity) {
+    reject_cnt++;
+    return false;
+  }
+
+  while(used + size > capacity) {
+    zswap_writeback();
+  }
+
+  struct zswap_entry *z = malloc(sizeof *z + size);
+  if(z == NULL) {
+    reject_cnt++;
+    return false;
+  }
+
+  z->slot = slot;
+  z->size = size;
+  memcpy(z->data, compress_buffer, size);
+  hash_insert(&zswap_table, &z->elem);
+  list_push_back(&zswap_lru, &z->lru_elem);
+  used += size;
+  store_cnt++;
+
+  return true;
+}
+
+/* Reads a page from the cache 
+   Takes the page to decompress into and the swap slot of the page
+   Returns false if the slot is not cached and must be read from the swap
+   device by the caller */
+bool zswap_load(void *page, size_t slot) {
+  if(!enabled) {
+    return false;
+  }
+
+  struct zswap_entry *z = zswap_find(slot);
+  if(z == NULL) {
+    miss_cnt++;
+    return false;
+  }
+
+  decompress_page(z->data, z->size, page);
+  hit_cnt++;
+  return true;
+}
+
+/* Drops the cached copy of a swap slot, if any, when the slot is freed */
+void zswap_invalidate(size_t slot) {
+  if(!enabled) {
+    return;
+  }
+
+  struct zswap_entry *z = zswap_find(slot);
+  if(z != NULL) {
+    zswap_remove(z);
+  }
+}
+
+/* Prints swap cache statistics if the cache is enabled */
+void zswap_print_stats(void) {
+  if(enabled) {
+    printf("Swap cache: %lld stores, %lld rejected, %lld hits, %lld misses, "
+	   "%lld writebacks\n",
+	   store_cnt, reject_cnt, hit_cnt, miss_cnt, writeback_cnt);
+  }
+}
@@ -0,0 +1,13 @@
+#ifndef VM_ZSWAP
+#define VM_ZSWAP
+
+#include <stdbool.h>
+#include <stddef.h>
+
+void zswap_init(size_t);
+bool zswap_store(const void *, size_t);
+bool zswap_load(void *, size_t);
+void zswap_invalidate(size_t);
+void zswap_print_stats(void);
+
+#endif